@@ -0,0 +1,342 @@
+/**
+ * @file bench.cpp
+ * @brief Benchmarks of the phases of a timestep, each timed on its own: building the tree (Spacetree::treegen), the collisions (the collisiongrid behind Spacetree::updatecollision), the force walk (bodygen::computeaccelerations, which is updateallacceleration when run on one thread), the Velocity-Verlet update (bodygen::update) and writing a snapshot in both formats. Built from bench.cpp and bodygen.cpp, without main.cpp
+ * @version 0.1
+ * @date 2026-10-16
+ *
+ */
+#include <iostream>
+#include <vector>
+#include <array>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#include "bodygen.hpp"
+
+
+using namespace std;
+
+/**
+ * @brief Settings of a benchmark run, given on the command line as --name value
+ * @param minbodies Fewest bodies of the generated sets
+ * @param maxbodies Most bodies of the generated sets. The sets have every power of 10 from minbodies up to this many bodies
+ * @param threads Thread counts the tree build and the force walk are run with. The other phases are serial and only run once per set
+ * @param repeats Number of times every phase is run. The best and the mean time are reported
+ * @param precision Scalar type of the bodies: "float", "double" or "long" (long double)
+ * @param fixtures Initial condition files benchmarked as they are, on top of the generated sets
+ * @param out File the results are written to as CSV, or empty for the standard output
+ */
+class benchsettings
+{
+    public:
+        size_t minbodies{10};
+        size_t maxbodies{1000000};
+        vector<size_t> threads{1};
+        size_t repeats{3};
+        string precision{"long"};
+        vector<string> fixtures{"testdata.csv", "gg.csv"};
+        string out;
+};
+
+/**
+ * @brief Makes a set of bodies, either spread uniformly over a cube like the bodies made by bodygen, or clustered in a Plummer sphere, where most of the bodies sit in a core a few percent of the size of the cube. A fixed seed is used, so every run benchmarks the same bodies
+ *
+ * @param n Number of bodies
+ * @param clustered Whether the bodies are clustered
+ * @return vector<body<T>> The bodies, with indices 0 to n - 1
+ */
+template <typename T>
+vector<body<T>> makeset(size_t n, bool clustered)
+{
+    mt19937_64 mt64(n);
+    uniform_real_distribution<double> unit(-1, 1);
+    vector<body<T>> bodies(n);
+    for(size_t i{0}; i < n; i++)
+    {
+        body<T> &b = bodies[i];
+        if(clustered)
+        {
+            //Radius of a Plummer sphere of scale 1E15 from its cumulative mass, capped at 10 scales
+            const double u = min(0.5*(unit(mt64) + 1) + 1E-12, 0.99);
+            const double r = 1E15/sqrt(pow(u, -2.0/3.0) - 1);
+            array<double,3> direction{0,0,0};
+            double length{0};
+            while(length < 1E-6 || length > 1)
+            {
+                direction = {unit(mt64), unit(mt64), unit(mt64)};
+                length = sqrt(direction[0]*direction[0] + direction[1]*direction[1] + direction[2]*direction[2]);
+            }
+            b.position = {(T) (r*direction[0]/length), (T) (r*direction[1]/length), (T) (r*direction[2]/length)};
+        }
+        else
+        {
+            b.position = {(T) (1E16*unit(mt64)), (T) (1E16*unit(mt64)), (T) (1E16*unit(mt64))};
+        }
+        b.velocity = {(T) (1000*unit(mt64)), (T) (1000*unit(mt64)), (T) (1000*unit(mt64))};
+        b.acceleration = {0,0,0};
+        b.newacceleration = {0,0,0};
+        b.mass = (T) (3E30*(unit(mt64) + 1)/2);
+        b.radius = (T) (1E9*(unit(mt64) + 1)/2);
+        b.index = (int) i;
+    }
+    return(bodies);
+}
+
+/**
+ * @brief Runs a phase repeats times and times every run, without the setup done before it
+ *
+ * @param repeats Number of runs
+ * @param setup Run before every run of phase, not timed
+ * @param phase The phase to time
+ * @return array<double,2> The best and the mean time of a run, in seconds
+ */
+array<double,2> timephase(size_t repeats, const function<void()> &setup, const function<void()> &phase)
+{
+    double best{0};
+    double total{0};
+    for(size_t r{0}; r < repeats; r++)
+    {
+        setup();
+        chrono::time_point start{chrono::steady_clock::now()};
+        phase();
+        chrono::duration<double> elapsed{chrono::steady_clock::now() - start};
+        best = (r == 0) ? elapsed.count() : min(best, elapsed.count());
+        total = total + elapsed.count();
+    }
+    const array<double,2> times{best, total/(double) repeats};
+    return(times);
+}
+
+/**
+ * @brief Benchmarks every phase on one set of bodies and writes a line of results per phase and thread count
+ *
+ * @param name Name of the set, written in the first column
+ * @param bodies The bodies
+ * @param settings Settings of the benchmark
+ * @param results Stream the results are written to
+ */
+template <typename T>
+void benchset(const string &name, const vector<body<T>> &bodies, const benchsettings &settings, ostream &results)
+{
+    const size_t n = bodies.size();
+    auto report = [&](size_t threads, const string &phase, const array<double,2> &times)
+    {
+        results << name << ',' << n << ',' << threads << ',' << phase << ',' << settings.repeats << ',' << times[0] << ',' << times[1] << '\n';
+        results.flush();
+    };
+    auto nothing = [](){};
+
+    region<T> space;
+    array<T,6> minmax{0,0,0,0,0,0};
+    for(size_t i{0}; i < n; i++)
+    {
+        for(size_t k{0}; k < 3; k++)
+        {
+            minmax[2*k] = min(minmax[2*k], bodies[i].position[k]);
+            minmax[2*k+1] = max(minmax[2*k+1], bodies[i].position[k]);
+        }
+    }
+    space.xrange = {minmax[0] - 1,minmax[1] + 1};
+    space.yrange = {minmax[2] - 1,minmax[3] + 1};
+    space.zrange = {minmax[4] - 1,minmax[5] + 1};
+
+    for(size_t t{0}; t < settings.threads.size(); t++)
+    {
+        const size_t threads = settings.threads[t];
+        simoptions options;
+        options.threads = threads;
+        unique_ptr<threadpool> pool;
+        if(threads > 1)
+        {
+            pool = make_unique<threadpool>(threads);
+        }
+        Nodearena<T> arena;
+        report(threads, "treegen", timephase(settings.repeats, [&](){ arena.bodies = bodies; }, [&]()
+        {
+            Spacetree<T> tree{space, arena, pool.get(), options.buildcutoff, options.leafsize, NULL, options.collisions};
+            tree.treegen();
+        }));
+        pool.reset();
+
+        bodygen<T> gen("bench.csv", 1, 1);
+        gen.setoptions(options);
+        gen.setbodies(bodies);
+        report(threads, "force", timephase(settings.repeats, nothing, [&](){ gen.computeaccelerations(); }));
+        if(t > 0)
+        {
+            continue;
+        }
+        report(threads, "update", timephase(settings.repeats, [&](){ gen.setbodies(bodies); gen.computeaccelerations(); }, [&](){ gen.update(); }));
+
+        vector<body<T>> scratch;
+        report(threads, "collide", timephase(settings.repeats, [&](){ scratch = bodies; }, [&]()
+        {
+            collisiongrid<T> grid;
+            grid.collide(scratch, 0, scratch.size(), false);
+        }));
+
+        snapshot<T> state;
+        report(threads, "writecsv", timephase(settings.repeats, nothing, [&](){ state.write("benchsnapshot.csv", bodies); }));
+        report(threads, "writebinary", timephase(settings.repeats, nothing, [&](){ state.write("benchsnapshot.nbs", bodies); }));
+        remove("benchsnapshot.csv");
+        remove("benchsnapshot.nbs");
+    }
+}
+
+/**
+ * @brief Runs the whole benchmark with bodies of scalar type T: the uniform and clustered sets of every size, then the fixtures
+ *
+ * @param settings Settings of the benchmark
+ */
+template <typename T>
+void runbench(const benchsettings &settings)
+{
+    ofstream file;
+    if(!settings.out.empty())
+    {
+        file.open(settings.out);
+    }
+    ostream &results = settings.out.empty() ? cout : file;
+    results << "set,bodies,threads,phase,repeats,best_seconds,mean_seconds\n";
+    for(size_t n{settings.minbodies}; n <= settings.maxbodies; n = n*10)
+    {
+        benchset<T>("uniform", makeset<T>(n, false), settings, results);
+        benchset<T>("clustered", makeset<T>(n, true), settings, results);
+    }
+    for(size_t f{0}; f < settings.fixtures.size(); f++)
+    {
+        vector<body<T>> bodies;
+        snapshot<T> initial;
+        if(!initial.read(settings.fixtures[f], bodies))
+        {
+            cerr << "Could not read " << settings.fixtures[f] << ", skipped\n";
+            continue;
+        }
+        benchset<T>(settings.fixtures[f], bodies, settings, results);
+    }
+}
+
+/**
+ * @brief Splits a comma separated list
+ *
+ * @param value The list
+ * @return vector<string> The items
+ */
+vector<string> splitlist(const string &value)
+{
+    vector<string> items;
+    size_t start{0};
+    while(start <= value.size())
+    {
+        size_t end = value.find(',', start);
+        if(end == string::npos)
+        {
+            end = value.size();
+        }
+        if(end > start)
+        {
+            items.push_back(value.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return(items);
+}
+
+/**
+ * @brief Reads the settings and runs the benchmark. Every option is given as --name value:
+ *  --minbodies N     fewest bodies of the generated sets (10 by default)
+ *  --maxbodies N     most bodies of the generated sets (1000000 by default). Every power of 10 in between gets a uniform and a clustered set
+ *  --threads LIST    comma separated thread counts for the tree build and the force walk (1 by default)
+ *  --repeats N       times every phase is run (3 by default)
+ *  --precision NAME  float, double or long (the default)
+ *  --fixtures LIST   comma separated initial condition files to benchmark as well (testdata.csv,gg.csv by default). Files that cannot be read are skipped
+ *  --out FILE        write the results to FILE instead of the standard output
+ * The results are CSV, one line per set, thread count and phase, with the best and the mean time of the runs
+ *
+ * @param argc Number of inputs
+ * @param argv The inputs
+ * @return int
+ */
+int main(int argc, char* argv[])
+{
+    benchsettings settings;
+    for(int i{1}; i < argc; i = i + 2)
+    {
+        const string arg = argv[i];
+        if(i + 1 >= argc)
+        {
+            std::cout << "Option " << arg << " needs a value\n";
+            return 0;
+        }
+        const string value = argv[i + 1];
+        if(arg == "--minbodies" || arg == "--maxbodies" || arg == "--repeats")
+        {
+            if(atoi(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - " << arg << " takes a positive integer.\n";
+                return 0;
+            }
+            size_t &target = (arg == "--minbodies") ? settings.minbodies : ((arg == "--maxbodies") ? settings.maxbodies : settings.repeats);
+            target = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--threads")
+        {
+            settings.threads.clear();
+            for(const string &item : splitlist(value))
+            {
+                if(atoi(item.c_str()) <= 0)
+                {
+                    std::cout << "Invalid inputs detected - --threads takes a comma separated list of positive integers.\n";
+                    return 0;
+                }
+                settings.threads.push_back((size_t) atoi(item.c_str()));
+            }
+            if(settings.threads.empty())
+            {
+                std::cout << "Invalid inputs detected - --threads takes a comma separated list of positive integers.\n";
+                return 0;
+            }
+        }
+        else if(arg == "--precision")
+        {
+            if(value != "float" && value != "double" && value != "long")
+            {
+                std::cout << "Invalid inputs detected - --precision takes float, double or long.\n";
+                return 0;
+            }
+            settings.precision = value;
+        }
+        else if(arg == "--fixtures")
+        {
+            settings.fixtures = splitlist(value);
+        }
+        else if(arg == "--out")
+        {
+            settings.out = value;
+        }
+        else
+        {
+            std::cout << "Unknown option " << arg << "\n";
+            return 0;
+        }
+    }
+    if(settings.precision == "float")
+    {
+        runbench<float>(settings);
+    }
+    else if(settings.precision == "double")
+    {
+        runbench<double>(settings);
+    }
+    else
+    {
+        runbench<long double>(settings);
+    }
+    return 0;
+}
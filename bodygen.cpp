@@ -17,6 +17,33 @@
 #include <fstream>
 #include <direct.h>
 #include <random>
+#include <algorithm>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMDKERNELS
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SIMDTARGET(isa)
+#else
+#define SIMDTARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
 
 #include "bodygen.hpp"
 
@@ -28,6 +55,49 @@ using namespace std;
  */
 long double G = 6.67E-11;
 
+/**
+ * @brief Number of octree levels encoded in a Morton key. Each level takes three bits (one per axis), so 21 levels fill 63 bits of an unsigned long long
+ * 
+ */
+const size_t mortonlevels{21};
+
+/**
+ * @brief How many levels deeper than when it was built a refitted tree can get before it is rebuilt
+ * 
+ */
+const size_t maxdepthgrowth{2};
+
+/**
+ * @brief A tree that is going to be refitted is built in a region padded by this fraction of its size on every side, so that the bodies at the edges do not leave it in the next timestep
+ * 
+ */
+const long double refitmargin{0.1};
+
+/**
+ * @brief With block timesteps, substeps on which more than 1/blockrebuild of the bodies are active get a tree updated by maintaintree rather than only refreshed
+ * 
+ */
+const size_t blockrebuild{10};
+
+/**
+ * @brief Cached interaction lists (see bodygen::updatecachedleaf) are made with an opening angle of options.theta times this, which leaves the bodies room to drift
+ * 
+ */
+const long double cachedopening{0.9};
+
+/**
+ * @brief The direct sum (see bodygen::directsum) goes over the bodies in blocks of this many, so that the positions and masses of a block stay in cache while every body of a range pulls from it
+ * 
+ */
+const size_t directblock{1024};
+
+/**
+ * @brief Smallest and largest opening angle bodygen::tunetheta picks from, and the number of angles it tries between them, spaced evenly on a log scale
+ * 
+ */
+const array<double,2> tunerange{0.05, 1.2};
+const size_t tunesteps{32};
+
 /**
  * @brief Overloaded operator + that adds the elements of two arrays to produce a third array
  * 
@@ -98,7 +168,7 @@ T operator*(const array<T,L> &v1, const array<T,L> &v2)
  * @return array<T,L> 
  */
 template <typename T, size_t L>
-array<T,L> operator*(const T &s, array<T,L> &v)
+array<T,L> operator*(const T &s, const array<T,L> &v)
 {
     array<T,L> returnval;
     for(size_t i{0}; i < L; i++)
@@ -108,79 +178,6 @@ array<T,L> operator*(const T &s, array<T,L> &v)
     return(returnval);
 }
 
-/**
- * @brief Overloaded operator >= that compares two arrays and determines if each element in the first array is greater than or equal to the corresponding element in the second array
- * 
- * @tparam T 
- * @tparam L 
- * @param v1 Input array 1
- * @param v2 Input array 1
- * @return true Returns true if all comparisons satisfy the condition
- * @return false Returns false if at least one comparison does not satisfy the condition
- */
-template <typename T, size_t L>
-bool operator>=(const array<T,L> &v1, const array<T,L> &v2)
-{
-    for(size_t i{0}; i < L; i++)
-    {
-        if(v1[i] >= v2[i])
-        {
-            continue;
-        }
-        else
-        {
-            return(false);
-        }  
-    }
-    return(true);
-}
-
-/**
- * @brief Overloaded operator < that compares two arrays and determines if each element in the first array is less than the corresponding element in the second array
- * 
- * @tparam T 
- * @tparam L 
- * @param v1 Input array 1
- * @param v2 Input array 1
- * @return true Returns true if all comparisons satisfy the condition
- * @return false Returns false if at least one comparison does not satisfy the condition
- */
-template <typename T, size_t L>
-bool operator<(const array<T,L> &v1, const array<T,L> &v2)
-{
-    for(size_t i{0}; i < L; i++)
-    {
-        if(v1[i] < v2[i])
-        {
-            continue;
-        }
-        else
-        {
-            return(false);
-        }  
-    }
-    return(true);
-}
-
-/**
- * @brief Overloaded operator == that compares two strings and determine if they are equal
- * 
- * @param a Input string 1
- * @param b Input string 2
- * @return true 
- * @return false 
- */
-bool operator==(const string &a, const string &b)
-{
-    for(size_t i{0}; i < a.size(); i++)
-    {
-        if(a[i] != b[i])
-        {
-            return(false);
-        }
-    }
-    return(true);
-}
 /**
  * @brief Overloaded operator << that writes out body data - position, velocity, mass and radius. 
  * 
@@ -188,7 +185,8 @@ bool operator==(const string &a, const string &b)
  * @param b body
  * @return ostream& 
  */
-ostream &operator<<(ostream &out, body &b)
+template <typename T>
+ostream &operator<<(ostream &out, const body<T> &b)
 {
     out << b.index << ',';
     for(size_t i{0}; i < 3; i++)
@@ -210,7 +208,8 @@ ostream &operator<<(ostream &out, body &b)
  * @param v vector of bodies
  * @return ostream& 
  */
-ostream &operator<<(ostream &out, vector<body> &v)
+template <typename T>
+ostream &operator<<(ostream &out, const vector<body<T>> &v)
 {
     out << "x coord" << ',' << "y coord" << ',' << "z coord" << ',' << "scalar\n";
     for(size_t i{0}; i < v.size(); i++)
@@ -270,618 +269,4789 @@ array<T,3> crossprod(array<T,3> &v1, array<T,3> &v2)
 
 
 /**
- * @brief Construct a new Spacetree:: Spacetree object
+ * @brief Collides two bodies elastically, updating both velocities. Only called if the distance between them is less than the sum of their radii
  * 
- * @param inputreg Initializes private member regi to this
+ * @param b1 Input body 1
+ * @param b2 Input body 2
  */
-Spacetree::Spacetree(region inputreg)
-    : regi{inputreg} {}
+template <typename T>
+void elasticcollision(body<T> &b1, body<T> &b2)
+{
+    const T fact1 = (2*b2.mass*((b1.velocity - b2.velocity)*(b1.position - b2.position))/((b1.mass + b2.mass)*moodulus(b1.position - b2.position)*moodulus(b1.position - b2.position)));
+    const T fact2 = (2*b1.mass*((b2.velocity - b1.velocity)*(b2.position - b1.position))/((b1.mass + b2.mass)*moodulus(b1.position - b2.position)*moodulus(b1.position - b2.position)));
+    array<T, 3> posdiff1 = b1.position - b2.position;
+    array<T, 3> posdiff2 = b2.position - b1.position;
+    b1.velocity = b1.velocity - fact1*posdiff1;
+    b2.velocity = b2.velocity - fact2*posdiff2;
+}
 
 /**
- * @brief Makes a tree given the input region regi
+ * @brief Merges two bodies that collide inelastically into b1, conserving mass and momentum, with a radius holding the volume of both. b2 is left with no mass and the index -1 - its index, which marks it for Spacetree::compact
  * 
- * @return Node* returns the tree
+ * @param b1 Input body 1, the merged body
+ * @param b2 Input body 2, the absorbed body
  */
-Node* Spacetree::treegen()
+template <typename T>
+void inelasticcollision(body<T> &b1, body<T> &b2)
 {
-    Node* root = new Node;
-    regi.checkcol = false;
-    root = makeatree(regi);
-    return(root);
+    const T mass = b1.mass + b2.mass;
+    const T w1 = (mass > 0) ? b1.mass/mass : (T) 0.5;
+    const T w2 = 1 - w1;
+    b1.position = w1*b1.position + w2*b2.position;
+    b1.velocity = w1*b1.velocity + w2*b2.velocity;
+    b1.acceleration = w1*b1.acceleration + w2*b2.acceleration;
+    b1.newacceleration = w1*b1.newacceleration + w2*b2.newacceleration;
+    b1.radius = cbrt(b1.radius*b1.radius*b1.radius + b2.radius*b2.radius*b2.radius);
+    b1.mass = mass;
+    b2.mass = 0;
+    b2.velocity = {0,0,0};
+    b2.index = -1 - b2.index;
 }
 
 /**
- * @brief Adds null nodes to a leaf node via a simple loop through all nodes the leaf node leads to
+ * @brief Integer coordinates of the grid cell a position falls in
  * 
- * @param newnode Input leaf node
- * @return Node* Returns the leaf node
+ * @param position Input position
+ * @return array<long long,3> 
  */
-Node* Spacetree::addnulls(Node* newnode)
+template <typename T>
+array<long long,3> collisiongrid<T>::cellof(const array<T,3> &position)
 {
-    for(size_t i{0}; i < 8; i++)
+    array<long long,3> cell;
+    for(size_t k{0}; k < 3; k++)
     {
-        newnode->Nodelist[i] = NULL;
+        cell[k] = (long long) floor((position[k] - origin[k])/cellsize);
     }
-    return(newnode);
-} 
+    return(cell);
+}
 
 /**
- * @brief Updates the velocities of all bodies in a vector if there are collisions. Two bodies will elastically collide if the distance between them is less than the sum of their radii
+ * @brief Packs the coordinates of a cell into one key, 21 bits per axis. Coordinates that do not fit wrap around, which only adds candidates that are then rejected by the exact distance check
  * 
- * @param bodyvector Input vector of bodies. Only two bodies can interact at a given moment.
- * @param indices Stores the used body indices. Bodies with these indices will be ignored 
- * @return vector<body> 
+ * @param cell Input cell coordinates
+ * @return unsigned long long 
  */
-vector<body> Spacetree::updatecollision(vector<body> &bodyvector)
+template <typename T>
+unsigned long long collisiongrid<T>::cellkey(const array<long long,3> &cell)
 {
-    vector<size_t> indices(0);
-    for(size_t i{0}; i < bodyvector.size(); i++)
-    {
-        for(size_t j{0}; j < bodyvector.size(); j++)
-        {
-            int check{0};
-            if(i == j)
-            {
-                continue;
-            }
-            for(size_t k{0}; k < indices.size(); k++)
-            {
-                if(i == indices[k] or j == indices[k])
-                {
-                    check = 1;
-                    break;
-                }
-            }
-            if(check == 1)
-            {
-                continue;
-            }
-            if(moodulus(bodyvector[i].position - bodyvector[j].position) < bodyvector[i].radius + bodyvector[j].radius)
-            {
-                const long double fact1 = (2*bodyvector[j].mass*((bodyvector[i].velocity - bodyvector[j].velocity)*(bodyvector[i].position - bodyvector[j].position))/((bodyvector[i].mass + bodyvector[j].mass)*moodulus(bodyvector[i].position - bodyvector[j].position)*moodulus(bodyvector[i].position - bodyvector[j].position)));
-                const long double fact2 = (2*bodyvector[i].mass*((bodyvector[j].velocity - bodyvector[i].velocity)*(bodyvector[j].position - bodyvector[i].position))/((bodyvector[i].mass + bodyvector[j].mass)*moodulus(bodyvector[i].position - bodyvector[j].position)*moodulus(bodyvector[i].position - bodyvector[j].position)));
-                array<long double, 3> posdiff1 = bodyvector[i].position - bodyvector[j].position;
-                array<long double, 3> posdiff2 = bodyvector[j].position - bodyvector[i].position;
-                bodyvector[i].velocity = bodyvector[i].velocity - fact1*posdiff1;
-                bodyvector[j].velocity = bodyvector[j].velocity - fact2*posdiff2;
-                indices.push_back(i);
-                indices.push_back(j);
-            }
-        }
-    }
-    return(bodyvector);
+    const unsigned long long mask = (1ULL << 21) - 1;
+    return((((unsigned long long) cell[0]) & mask) | ((((unsigned long long) cell[1]) & mask) << 21) | ((((unsigned long long) cell[2]) & mask) << 42));
 }
 
-
 /**
- * @brief Recursively makes a tree given some input region. Values such as mass, center of gravity, extent from the region are stored in the current node, before the region is subdivided into eight and the function is recursively called on each subdivision. Collisions are also updated here, but only if the extent of a region is 10 times the maximum radius of all bodies in that region
+ * @brief Collides the bodies in a range of a vector. The candidates for a body are the bodies in the 27 cells around it, in a grid whose cells are as wide as the largest diameter in the range.
+ * The pairs are the same as in a check of every pair: each body that has not collided yet collides with the first body it touches that has not collided yet either
+ * With merge, the pairs are merged by inelasticcollision instead, and bodies absorbed earlier (those with a negative index) take no part
  * 
- * @param reg Input region that stores boundaries and a vector of bodies inside the region
- * @return Node* Returns the tree
+ * @param bods Input vector of bodies
+ * @param first Index of the first body of the range
+ * @param last One past the index of the last body of the range
+ * @param merge Whether colliding bodies merge instead of bouncing off each other
+ * @return size_t Number of pairs whose distance was checked
  */
-Node* Spacetree::makeatree(region reg)
+template <typename T>
+size_t collisiongrid<T>::collide(vector<body<T>> &bods, size_t first, size_t last, bool merge)
 {
-    Node* pointer = new Node;
-    pointer->nodepath = reg.regnodepath;
-    if(reg.bodiesinregion.size() == 1)
+    const size_t n = last - first;
+    size_t checks{0};
+    T maxrad{0};
+    origin = bods[first].position;
+    for(size_t i{first}; i < last; i++)
     {
-        pointer = addnulls(pointer);
-        pointer->isleaf = true;
-        pointer->solebody = reg.bodiesinregion[0];
-        pointer->cog = pointer->solebody.position;
-        pointer->cogmass = pointer->solebody.mass;
-        pointer->extent = 0;
-        return(pointer);
-    }
-    pointer->isleaf = false;
-    
-    long double totmass{0};
-    long double extent{0};
-    array<long double, 3> tempcog = {0,0,0};
-    vector<body> regbods = reg.bodiesinregion;
-    long double maxrad{0};
-    for(size_t h{0}; h < regbods.size(); h++)
-    {
-        totmass = totmass + regbods[h].mass;
-        if(regbods[h].radius > maxrad)
+        if(bods[i].radius > maxrad)
         {
-            maxrad = regbods[h].radius;
-        }      
+            maxrad = bods[i].radius;
+        }
+        for(size_t k{0}; k < 3; k++)
+        {
+            if(bods[i].position[k] < origin[k])
+            {
+                origin[k] = bods[i].position[k];
+            }
+        }
     }
-    for(size_t hh{0}; hh < regbods.size(); hh++)
+    if(maxrad <= 0)
     {
-        tempcog = tempcog + ((regbods[hh].mass)/(totmass))*regbods[hh].position;
+        return(checks);
     }
-    for(size_t hhh{0}; hhh < regbods.size(); hhh++)
+    cellsize = 2*maxrad;
+
+    cells.resize(n);
+    for(size_t i{0}; i < n; i++)
     {
-        extent = extent + moodulus(regbods[hhh].position - tempcog);
+        cells[i] = {cellkey(cellof(bods[first + i].position)), i};
     }
-    
-    pointer->cogmass = totmass;
-    pointer->cog = tempcog;
-    pointer->extent = 2*extent/regbods.size();
-
-    
-    
-    if(2*extent/regbods.size() < 10*maxrad && !reg.checkcol)
+    sort(cells.begin(), cells.end());
+    collided.assign(n, false);
+    if(merge)
     {
-        reg.bodiesinregion = updatecollision(reg.bodiesinregion);
-        reg.checkcol = true;
+        for(size_t i{0}; i < n; i++)
+        {
+            collided[i] = bods[first + i].index < 0;
+        }
     }
-    
-    long double xboxlength = (reg.xrange[1] - reg.xrange[0])/2;
-    long double yboxlength = (reg.yrange[1] - reg.yrange[0])/2;
-    long double zboxlength = (reg.zrange[1] - reg.zrange[0])/2;  
-
-    array<region,8> regionlist; 
-    array<string,8> pathnames = {"dll","dlr","dal","dar","ull","ulr","ual","uar"};
-    
-    regionlist[0].xrange = {reg.xrange[0], reg.xrange[0] + xboxlength};
-    regionlist[0].yrange = {reg.yrange[0], reg.yrange[0] + yboxlength};
-    regionlist[0].zrange = {reg.zrange[0], reg.zrange[0] + zboxlength};
-
-    regionlist[7].xrange = {reg.xrange[0]+xboxlength, reg.xrange[1]};
-    regionlist[7].yrange = {reg.yrange[0]+yboxlength, reg.yrange[1]};
-    regionlist[7].zrange = {reg.zrange[0]+zboxlength, reg.zrange[1]};
-
-    regionlist[1].xrange = {reg.xrange[0]+xboxlength, reg.xrange[1]};
-    regionlist[1].yrange = {reg.yrange[0], reg.yrange[0] + yboxlength};
-    regionlist[1].zrange = {reg.zrange[0], reg.zrange[0] + zboxlength};
-
-    regionlist[2].xrange = {reg.xrange[0], reg.xrange[0] + xboxlength};
-    regionlist[2].yrange = {reg.yrange[0]+yboxlength, reg.yrange[1]};
-    regionlist[2].zrange = {reg.zrange[0], reg.zrange[0] + zboxlength};
 
-    regionlist[3].xrange = {reg.xrange[0]+xboxlength, reg.xrange[1]};
-    regionlist[3].yrange = {reg.yrange[0]+yboxlength, reg.yrange[1]};
-    regionlist[3].zrange = {reg.zrange[0], reg.zrange[0] + zboxlength};
-
-    regionlist[4].xrange = {reg.xrange[0], reg.xrange[0] + xboxlength};
-    regionlist[4].yrange = {reg.yrange[0], reg.yrange[0] + yboxlength};
-    regionlist[4].zrange = {reg.zrange[0]+zboxlength, reg.zrange[1]};
-
-    regionlist[5].xrange = {reg.xrange[0]+xboxlength, reg.xrange[1]};
-    regionlist[5].yrange = {reg.yrange[0], reg.yrange[0] + yboxlength};
-    regionlist[5].zrange = {reg.zrange[0]+zboxlength, reg.zrange[1]};
-
-    regionlist[6].xrange = {reg.xrange[0], reg.xrange[0] + xboxlength};
-    regionlist[6].yrange = {reg.yrange[0]+yboxlength, reg.yrange[1]};
-    regionlist[6].zrange = {reg.zrange[0]+zboxlength, reg.zrange[1]};    
-
-
-    for(size_t i{0}; i < 8; i++)
+    for(size_t i{0}; i < n; i++)
     {
-        vector<body> newbodiesinregion(0);
-        regionlist[i].bodiesinregion = newbodiesinregion;
-        regionlist[i].regnodepath = reg.regnodepath + pathnames[i];
-        array<long double, 3> minranges = {regionlist[i].xrange[0], regionlist[i].yrange[0], regionlist[i].zrange[0]};
-        array<long double, 3> maxranges = {regionlist[i].xrange[1], regionlist[i].yrange[1], regionlist[i].zrange[1]};
-        for(size_t j{0}; j < reg.bodiesinregion.size(); j++)
+        if(collided[i])
         {
-            if (reg.bodiesinregion[j].position >= minranges && reg.bodiesinregion[j].position < maxranges)
-            {
-                regionlist[i].bodiesinregion.push_back(reg.bodiesinregion[j]);
-            }
-            else
+            continue;
+        }
+        const array<long long,3> cell = cellof(bods[first + i].position);
+        size_t partner = n;
+        for(long long dx{-1}; dx <= 1; dx++)
+        {
+            for(long long dy{-1}; dy <= 1; dy++)
             {
-                continue;
+                for(long long dz{-1}; dz <= 1; dz++)
+                {
+                    const unsigned long long key = cellkey({cell[0] + dx, cell[1] + dy, cell[2] + dz});
+                    auto candidate = lower_bound(cells.begin(), cells.end(), make_pair(key, (size_t) 0));
+                    for(; candidate != cells.end() && candidate->first == key; candidate++)
+                    {
+                        const size_t j = candidate->second;
+                        if(j == i || j >= partner || collided[j])
+                        {
+                            continue;
+                        }
+                        checks = checks + 1;
+                        if(moodulus(bods[first + i].position - bods[first + j].position) < bods[first + i].radius + bods[first + j].radius)
+                        {
+                            partner = j;
+                        }
+                    }
+                }
             }
         }
-
-        if(regionlist[i].bodiesinregion.size() >= 1)
+        if(partner < n)
         {
-            if(reg.checkcol)
+            if(merge)
             {
-                regionlist[i].checkcol = true;
+                inelasticcollision(bods[first + i], bods[first + partner]);
             }
             else
             {
-                regionlist[i].checkcol = false;
+                elasticcollision(bods[first + i], bods[first + partner]);
             }
-            pointer->Nodelist[i] = makeatree(regionlist[i]);
-        }
-        else if(regionlist[i].bodiesinregion.size() == 0)
-        {
-            pointer->Nodelist[i] = NULL;
+            collided[i] = true;
+            collided[partner] = true;
         }
     }
-    return(pointer);
+    return(checks);
 }
 
 /**
- * @brief Construct a new bodygen::bodygen object. This constructor is called if there is an input file.
+ * @brief Bytes of memory held by the grid, used or not
  * 
- * @param inputstring Initializes filename to inputstring. This is the desired filename to read
- * @param tstepinput Initializes timestep to tstepinput. This is the desired timestep
- * @param iter Initializes iter to iterations. This is the total number of iterations
+ * @return size_t 
  */
-bodygen::bodygen(const string inputstring, long double tstepinput, const size_t iter)
-    : filename{inputstring}, timestep{tstepinput}, iterations{iter} 
+template <typename T>
+size_t collisiongrid<T>::bytes()
 {
-    bodyvector.resize(0);
-    writeinitfile = false;
+    return(cells.capacity()*sizeof(pair<unsigned long long, size_t>) + collided.capacity()/8);
 }
 
 /**
- * @brief Construct a new bodygen::bodygen object. This constructor is called if there is no input file.
+ * @brief Resizes all the arrays
  * 
- * @param inputcount Initializes count to inputcount. This is the desired number of bodies
- * @param st Initializes filename to st. This is the desired filename to write the generate initial data to
- * @param tstepinput Initializes timestep to tstepinput. This is the desired timestep
- * @param iter Initializes iter to iterations. This is the total number of iterations
+ * @param n New number of point masses
  */
-bodygen::bodygen(const size_t inputcount, const string st, long double tstepinput, const size_t iter)
-    : count{inputcount}, filename{st}, timestep{tstepinput}, iterations{iter} 
-{                                                                           
-    bodyvector.resize(0);
-    writeinitfile = true;
+template <typename T>
+void pointmasses<T>::resize(size_t n)
+{
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    m.resize(n);
+    qxx.resize(n);
+    qxy.resize(n);
+    qxz.resize(n);
+    qyy.resize(n);
+    qyz.resize(n);
+    qzz.resize(n);
 }
 
 /**
- * @brief Recursively deletes a tree, and frees up the memory occupied by the tree
+ * @brief Sums m*(r - pos)/|r - pos|^3 over the point masses listed from position first of list on (G is left out). The separation is taken in T, the rest of each interaction is computed in K, and the sum is kept in T
  * 
- * @param tree Input tree to delete
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param first Position in list to start at
+ * @param src Point masses
+ * @return array<T,3> 
  */
-void bodygen::deletetree(Node* tree)
+template <typename T, typename K>
+array<T,3> forcesum(const array<T,3> &pos, const vector<int> &list, size_t first, const pointmasses<T> &src)
 {
-    if(tree == NULL)
+    array<T,3> acc = {0,0,0};
+    for(size_t k{first}; k < list.size(); k++)
     {
-        return;
+        const int j = list[k];
+        const T dx = src.x[j] - pos[0];
+        const T dy = src.y[j] - pos[1];
+        const T dz = src.z[j] - pos[2];
+        const K invr = 1/sqrt((K) (dx*dx + dy*dy + dz*dz));
+        const T f = (T) ((K) src.m[j]*invr*invr*invr);
+        acc[0] = acc[0] + f*dx;
+        acc[1] = acc[1] + f*dy;
+        acc[2] = acc[2] + f*dz;
     }
-    for(size_t i{0}; i < 8; i++)
+    return(acc);
+}
+
+/**
+ * @brief Scalar force kernel, used for long double and when the CPU has no AVX2. Sums over the whole list with forcesum
+ * 
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param src Point masses
+ * @return array<T,3> 
+ */
+template <typename T, typename K>
+array<T,3> forcekernelscalar(const array<T,3> &pos, const vector<int> &list, const pointmasses<T> &src)
+{
+    return(forcesum<T,K>(pos, list, 0, src));
+}
+
+/**
+ * @brief Quadrupole part of the acceleration from the point masses listed, to be added to that of a force kernel (G is left out). With u = r/|r| and Q' = Q/|r|^2 this is m/|r|^2 * (2.5*(u.Q'u)*u - Q'u), which keeps every intermediate value in the range of float. The separation is taken in T, the rest in K
+ * 
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param src Point masses, with their quadrupoles
+ * @return array<T,3> 
+ */
+template <typename T, typename K>
+array<T,3> quadrupolekernel(const array<T,3> &pos, const vector<int> &list, const pointmasses<T> &src)
+{
+    array<T,3> acc = {0,0,0};
+    for(size_t k{0}; k < list.size(); k++)
     {
-        deletetree(tree->Nodelist[i]);
+        const int j = list[k];
+        const T dx = src.x[j] - pos[0];
+        const T dy = src.y[j] - pos[1];
+        const T dz = src.z[j] - pos[2];
+        const K invr = 1/sqrt((K) (dx*dx + dy*dy + dz*dz));
+        const K ux = (K) dx*invr;
+        const K uy = (K) dy*invr;
+        const K uz = (K) dz*invr;
+        const K qxx = ((K) src.qxx[j]*invr)*invr;
+        const K qxy = ((K) src.qxy[j]*invr)*invr;
+        const K qxz = ((K) src.qxz[j]*invr)*invr;
+        const K qyy = ((K) src.qyy[j]*invr)*invr;
+        const K qyz = ((K) src.qyz[j]*invr)*invr;
+        const K qzz = ((K) src.qzz[j]*invr)*invr;
+        const K qux = qxx*ux + qxy*uy + qxz*uz;
+        const K quy = qxy*ux + qyy*uy + qyz*uz;
+        const K quz = qxz*ux + qyz*uy + qzz*uz;
+        const K uqu = ux*qux + uy*quy + uz*quz;
+        const K f = ((K) src.m[j]*invr)*invr;
+        acc[0] = acc[0] + (T) (f*((K) 2.5*uqu*ux - qux));
+        acc[1] = acc[1] + (T) (f*((K) 2.5*uqu*uy - quy));
+        acc[2] = acc[2] + (T) (f*((K) 2.5*uqu*uz - quz));
     }
-    delete tree;
+    return(acc);
 }
 
+#ifdef SIMDKERNELS
 /**
- * @brief The main function that does the Nbody simulation. Either a file is read, or data is generated. Updating functions are run to update the bodies before the tree is deleted and remade.
+ * @brief Gathers four doubles from base at idx for the AVX2 kernels. The same as _mm256_i32gather_pd, but with every lane switched on explicitly over a zeroed source, which GCC does not warn is used uninitialized
  * 
+ * @param base Array to gather from
+ * @param idx Indices into base
+ * @return __m256d 
  */
-void bodygen::simulate()
+SIMDTARGET("avx2,fma") __m256d gatherpd(const double* base, __m128i idx)
 {
-    if(writeinitfile)
+    return(_mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, idx, _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8));
+}
+
+/**
+ * @brief AVX2 force kernel in double. Same as forcekernelscalar, but four point masses at a time are gathered from src into the lanes of a vector register
+ * 
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param src Point masses
+ * @return array<double,3> 
+ */
+SIMDTARGET("avx2,fma") array<double,3> forcekernelavx2(const array<double,3> &pos, const vector<int> &list, const pointmasses<double> &src)
+{
+    const __m256d px = _mm256_set1_pd(pos[0]);
+    const __m256d py = _mm256_set1_pd(pos[1]);
+    const __m256d pz = _mm256_set1_pd(pos[2]);
+    const __m256d one = _mm256_set1_pd(1);
+    __m256d ax = _mm256_setzero_pd();
+    __m256d ay = _mm256_setzero_pd();
+    __m256d az = _mm256_setzero_pd();
+    size_t k{0};
+    for(; k + 4 <= list.size(); k = k + 4)
     {
-        datatree = makebodies(); //Make bodies if theres no initial data file
+        const __m128i idx = _mm_loadu_si128((const __m128i*) (list.data() + k));
+        const __m256d dx = _mm256_sub_pd(gatherpd(src.x.data(), idx), px);
+        const __m256d dy = _mm256_sub_pd(gatherpd(src.y.data(), idx), py);
+        const __m256d dz = _mm256_sub_pd(gatherpd(src.z.data(), idx), pz);
+        const __m256d m = gatherpd(src.m.data(), idx);
+        const __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz)));
+        const __m256d invr = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+        const __m256d f = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(m, invr), invr), invr);
+        ax = _mm256_fmadd_pd(f, dx, ax);
+        ay = _mm256_fmadd_pd(f, dy, ay);
+        az = _mm256_fmadd_pd(f, dz, az);
     }
-    else
+    alignas(32) double lanes[3][4];
+    _mm256_store_pd(lanes[0], ax);
+    _mm256_store_pd(lanes[1], ay);
+    _mm256_store_pd(lanes[2], az);
+    array<double,3> acc;
+    for(size_t c{0}; c < 3; c++)
     {
-        string infolist[8];
-        string radiuss;
-        ifstream file(filename); //Opens initial data file
-        array<long double, 6> minmax = {0,0,0,0,0,0};
-        int previndex{-1};
-        while(file.is_open() == true)
-        {
-            body newbody;
-            for(size_t i{0}; i < 8; i++)
-            {
-                getline(file, infolist[i], ',');
-            }
-            getline(file, radiuss, '\n');
-            if(stoi(infolist[0]) == previndex)
-            {
-                break;
-            }
-            newbody.index = stoi(infolist[0]);
-            newbody.position = {stold(infolist[1]),stold(infolist[2]),stold(infolist[3])};
-            newbody.velocity = {stold(infolist[4]),stold(infolist[5]),stold(infolist[6])};
-            newbody.mass = stold(infolist[7]);
-            newbody.radius = stold(radiuss);
-            newbody.acceleration = {0,0,0};
-            newbody.newacceleration = {0,0,0};
-            bodyvector.push_back(newbody);
-            previndex = newbody.index;
+        acc[c] = (lanes[c][0] + lanes[c][1]) + (lanes[c][2] + lanes[c][3]);
+    }
+    array<double,3> tail = forcesum<double,double>(pos, list, k, src);
+    return(acc + tail);
+}
 
-            size_t k2{0};
-            for(size_t k{0}; k < 3; k++)
-            {
-                if(newbody.position[k] < minmax[k2])
-                {
-                    minmax[k2] = newbody.position[k];
-                }
-                else if(newbody.position[k] > minmax[k2+1])
-                {
-                    minmax[k2+1] = newbody.position[k];
-                }
-                k2 = k2 + 2;
-            }
-        }
-        file.close();
-        space.xrange = {minmax[0] - 1,minmax[1] + 1};
-        space.yrange = {minmax[2] - 1,minmax[3] + 1};
-        space.zrange = {minmax[4] - 1,minmax[5] + 1};
-        space.bodiesinregion = bodyvector;
-        Spacetree space_tree{space};
-        datatree = space_tree.treegen();
+/**
+ * @brief AVX2 force kernel in float, with eight point masses at a time
+ * 
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param src Point masses
+ * @return array<float,3> 
+ */
+SIMDTARGET("avx2,fma") array<float,3> forcekernelavx2(const array<float,3> &pos, const vector<int> &list, const pointmasses<float> &src)
+{
+    const __m256 px = _mm256_set1_ps(pos[0]);
+    const __m256 py = _mm256_set1_ps(pos[1]);
+    const __m256 pz = _mm256_set1_ps(pos[2]);
+    const __m256 one = _mm256_set1_ps(1);
+    __m256 ax = _mm256_setzero_ps();
+    __m256 ay = _mm256_setzero_ps();
+    __m256 az = _mm256_setzero_ps();
+    size_t k{0};
+    for(; k + 8 <= list.size(); k = k + 8)
+    {
+        const __m256i idx = _mm256_loadu_si256((const __m256i*) (list.data() + k));
+        const __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(src.x.data(), idx, 4), px);
+        const __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(src.y.data(), idx, 4), py);
+        const __m256 dz = _mm256_sub_ps(_mm256_i32gather_ps(src.z.data(), idx, 4), pz);
+        const __m256 m = _mm256_i32gather_ps(src.m.data(), idx, 4);
+        const __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+        const __m256 invr = _mm256_div_ps(one, _mm256_sqrt_ps(r2));
+        const __m256 f = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(m, invr), invr), invr);
+        ax = _mm256_fmadd_ps(f, dx, ax);
+        ay = _mm256_fmadd_ps(f, dy, ay);
+        az = _mm256_fmadd_ps(f, dz, az);
     }
-    string strdirname = filename.substr(0, filename.size()-4);
-    const char* dirname = strdirname.c_str();
-    mkdir(dirname);
-    array<long double,6> minimaxi;
-    size_t j{0};
-    int ccount{0};
-    for(size_t i{0}; i < iterations; i++)
+    alignas(32) float lanes[3][8];
+    _mm256_store_ps(lanes[0], ax);
+    _mm256_store_ps(lanes[1], ay);
+    _mm256_store_ps(lanes[2], az);
+    array<float,3> acc = {0,0,0};
+    for(size_t c{0}; c < 3; c++)
     {
-        datatree = updateallacceleration(datatree, datatree);
-        datatree = update(datatree);
-        if(j == 100)
+        for(size_t l{0}; l < 8; l++)
         {
-            ofstream datafile;
-            datafile.precision(30);
-            filename = ".\\" + strdirname + "\\" + strdirname + ".csv." + to_string(ccount);
-            datafile.open(filename);
-            datafile << fixed << bodyvector;
-            datafile.close();
-            j = 0;
-            ccount = ccount + 1;
+            acc[c] = acc[c] + lanes[c][l];
         }
-        minimaxi = calcminmax();
-        space.xrange = {minimaxi[0] - 1,minimaxi[1] + 1};
-        space.yrange = {minimaxi[2] - 1,minimaxi[3] + 1};
-        space.zrange = {minimaxi[4] - 1,minimaxi[5] + 1};
-        space.bodiesinregion = bodyvector;
-        Spacetree space_tree{space};
-        deletetree(datatree);
-        datatree = space_tree.treegen();
-        j = j + 1;
     }
+    array<float,3> tail = forcesum<float,float>(pos, list, k, src);
+    return(acc + tail);
 }
 
 /**
- * @brief Calculates the boundaries of a region
+ * @brief AVX2 mixed precision force kernel: the separations are taken in double, the inverse cube of the distance is computed in float, and the sums are kept in double
  * 
- * @return array<long double,6> 
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param src Point masses
+ * @return array<double,3> 
  */
-array<long double,6> bodygen::calcminmax()
+SIMDTARGET("avx2,fma") array<double,3> forcekernelavx2mixed(const array<double,3> &pos, const vector<int> &list, const pointmasses<double> &src)
 {
-    array<long double,6> minmax{0,0,0,0,0,0};
-    for(size_t i{0}; i < bodyvector.size(); i++)
+    const __m256d px = _mm256_set1_pd(pos[0]);
+    const __m256d py = _mm256_set1_pd(pos[1]);
+    const __m256d pz = _mm256_set1_pd(pos[2]);
+    const __m128 one = _mm_set1_ps(1);
+    __m256d ax = _mm256_setzero_pd();
+    __m256d ay = _mm256_setzero_pd();
+    __m256d az = _mm256_setzero_pd();
+    size_t k{0};
+    for(; k + 4 <= list.size(); k = k + 4)
     {
-        size_t k2{0};
-        for(size_t k{0}; k < 3; k++)
-        {
-            if(bodyvector[i].position[k] < minmax[k2])
+        const __m128i idx = _mm_loadu_si128((const __m128i*) (list.data() + k));
+        const __m256d dx = _mm256_sub_pd(gatherpd(src.x.data(), idx), px);
+        const __m256d dy = _mm256_sub_pd(gatherpd(src.y.data(), idx), py);
+        const __m256d dz = _mm256_sub_pd(gatherpd(src.z.data(), idx), pz);
+        const __m128 m = _mm256_cvtpd_ps(gatherpd(src.m.data(), idx));
+        const __m128 r2 = _mm256_cvtpd_ps(_mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz))));
+        const __m128 invr = _mm_div_ps(one, _mm_sqrt_ps(r2));
+        const __m256d f = _mm256_cvtps_pd(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(m, invr), invr), invr));
+        ax = _mm256_fmadd_pd(f, dx, ax);
+        ay = _mm256_fmadd_pd(f, dy, ay);
+        az = _mm256_fmadd_pd(f, dz, az);
+    }
+    alignas(32) double lanes[3][4];
+    _mm256_store_pd(lanes[0], ax);
+    _mm256_store_pd(lanes[1], ay);
+    _mm256_store_pd(lanes[2], az);
+    array<double,3> acc;
+    for(size_t c{0}; c < 3; c++)
+    {
+        acc[c] = (lanes[c][0] + lanes[c][1]) + (lanes[c][2] + lanes[c][3]);
+    }
+    array<double,3> tail = forcesum<double,float>(pos, list, k, src);
+    return(acc + tail);
+}
+
+/**
+ * @brief Sums the lanes of a vector register stored to lanes by adding the upper half of the lanes onto the lower half until one is left. This is the order _mm512_reduce_add_pd and _mm512_reduce_add_ps add in, without the uninitialized register GCC warns about in them
+ * 
+ * @tparam T 
+ * @param lanes The stored lanes, overwritten
+ * @param width Number of lanes, a power of 2
+ * @return T 
+ */
+template <typename T>
+T addlanes(T* lanes, size_t width)
+{
+    for(; width > 1; width = width/2)
+    {
+        for(size_t i{0}; i < width/2; i++)
+        {
+            lanes[i] = lanes[i] + lanes[i + width/2];
+        }
+    }
+    return(lanes[0]);
+}
+
+/**
+ * @brief Loads the next (up to) eight indices of an interaction list for the AVX-512 kernels. Lanes past the end of the list get index 0 and are switched off in the returned mask
+ * 
+ * @param list Interaction list
+ * @param k Position in the list
+ * @param lanes Mask of the lanes in use
+ * @return __m256i 
+ */
+SIMDTARGET("avx512f") __m256i loadindices(const vector<int> &list, size_t k, __mmask8 &lanes)
+{
+    const size_t left = list.size() - k;
+    if(left >= 8)
+    {
+        lanes = 0xff;
+        return(_mm256_loadu_si256((const __m256i*) (list.data() + k)));
+    }
+    alignas(32) int tail[8] = {0,0,0,0,0,0,0,0};
+    for(size_t t{0}; t < left; t++)
+    {
+        tail[t] = list[k + t];
+    }
+    lanes = (__mmask8) ((1u << left) - 1);
+    return(_mm256_load_si256((const __m256i*) tail));
+}
+
+/**
+ * @brief AVX-512 force kernel in double. Same as the AVX2 one with eight lanes, and the leftover point masses are done with a masked gather instead of a scalar loop
+ * 
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param src Point masses
+ * @return array<double,3> 
+ */
+SIMDTARGET("avx512f") array<double,3> forcekernelavx512(const array<double,3> &pos, const vector<int> &list, const pointmasses<double> &src)
+{
+    const __m512d px = _mm512_set1_pd(pos[0]);
+    const __m512d py = _mm512_set1_pd(pos[1]);
+    const __m512d pz = _mm512_set1_pd(pos[2]);
+    const __m512d one = _mm512_set1_pd(1);
+    __m512d ax = _mm512_setzero_pd();
+    __m512d ay = _mm512_setzero_pd();
+    __m512d az = _mm512_setzero_pd();
+    for(size_t k{0}; k < list.size(); k = k + 8)
+    {
+        __mmask8 lanes;
+        const __m256i idx = loadindices(list, k, lanes);
+        const __m512d dx = _mm512_sub_pd(_mm512_mask_i32gather_pd(px, lanes, idx, src.x.data(), 8), px);
+        const __m512d dy = _mm512_sub_pd(_mm512_mask_i32gather_pd(py, lanes, idx, src.y.data(), 8), py);
+        const __m512d dz = _mm512_sub_pd(_mm512_mask_i32gather_pd(pz, lanes, idx, src.z.data(), 8), pz);
+        const __m512d m = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), lanes, idx, src.m.data(), 8);
+        const __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+        //Unused lanes have r2 = 0, so their 1/r is set to 0 instead of infinity
+        const __m512d invr = _mm512_maskz_div_pd(lanes, one, _mm512_maskz_sqrt_pd(lanes, r2));
+        const __m512d f = _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(m, invr), invr), invr);
+        ax = _mm512_fmadd_pd(f, dx, ax);
+        ay = _mm512_fmadd_pd(f, dy, ay);
+        az = _mm512_fmadd_pd(f, dz, az);
+    }
+    alignas(64) double lanes[3][8];
+    _mm512_store_pd(lanes[0], ax);
+    _mm512_store_pd(lanes[1], ay);
+    _mm512_store_pd(lanes[2], az);
+    array<double,3> acc = {addlanes(lanes[0], 8), addlanes(lanes[1], 8), addlanes(lanes[2], 8)};
+    return(acc);
+}
+
+/**
+ * @brief AVX-512 force kernel in float, with sixteen point masses at a time
+ * 
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param src Point masses
+ * @return array<float,3> 
+ */
+SIMDTARGET("avx512f") array<float,3> forcekernelavx512(const array<float,3> &pos, const vector<int> &list, const pointmasses<float> &src)
+{
+    const __m512 px = _mm512_set1_ps(pos[0]);
+    const __m512 py = _mm512_set1_ps(pos[1]);
+    const __m512 pz = _mm512_set1_ps(pos[2]);
+    const __m512 one = _mm512_set1_ps(1);
+    __m512 ax = _mm512_setzero_ps();
+    __m512 ay = _mm512_setzero_ps();
+    __m512 az = _mm512_setzero_ps();
+    for(size_t k{0}; k < list.size(); k = k + 16)
+    {
+        __mmask8 lowlanes;
+        __mmask8 highlanes{0};
+        const __m256i lowidx = loadindices(list, k, lowlanes);
+        __m256i highidx = _mm256_setzero_si256();
+        if(k + 8 < list.size())
+        {
+            highidx = loadindices(list, k + 8, highlanes);
+        }
+        const __m512i lowhalf = _mm512_maskz_inserti64x4(0xff, _mm512_setzero_si512(), lowidx, 0);
+        const __m512i idx = _mm512_maskz_inserti64x4(0xff, lowhalf, highidx, 1);
+        const __mmask16 lanes = (__mmask16) (lowlanes | (((unsigned) highlanes) << 8));
+        const __m512 dx = _mm512_sub_ps(_mm512_mask_i32gather_ps(px, lanes, idx, src.x.data(), 4), px);
+        const __m512 dy = _mm512_sub_ps(_mm512_mask_i32gather_ps(py, lanes, idx, src.y.data(), 4), py);
+        const __m512 dz = _mm512_sub_ps(_mm512_mask_i32gather_ps(pz, lanes, idx, src.z.data(), 4), pz);
+        const __m512 m = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes, idx, src.m.data(), 4);
+        const __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+        const __m512 invr = _mm512_maskz_div_ps(lanes, one, _mm512_maskz_sqrt_ps(lanes, r2));
+        const __m512 f = _mm512_mul_ps(_mm512_mul_ps(_mm512_mul_ps(m, invr), invr), invr);
+        ax = _mm512_fmadd_ps(f, dx, ax);
+        ay = _mm512_fmadd_ps(f, dy, ay);
+        az = _mm512_fmadd_ps(f, dz, az);
+    }
+    alignas(64) float lanes[3][16];
+    _mm512_store_ps(lanes[0], ax);
+    _mm512_store_ps(lanes[1], ay);
+    _mm512_store_ps(lanes[2], az);
+    array<float,3> acc = {addlanes(lanes[0], 16), addlanes(lanes[1], 16), addlanes(lanes[2], 16)};
+    return(acc);
+}
+
+/**
+ * @brief AVX-512 mixed precision force kernel. Same as the AVX2 one with eight lanes
+ * 
+ * @param pos Position the acceleration is evaluated at
+ * @param list Indices of the point masses in src
+ * @param src Point masses
+ * @return array<double,3> 
+ */
+SIMDTARGET("avx512f") array<double,3> forcekernelavx512mixed(const array<double,3> &pos, const vector<int> &list, const pointmasses<double> &src)
+{
+    const __m512d px = _mm512_set1_pd(pos[0]);
+    const __m512d py = _mm512_set1_pd(pos[1]);
+    const __m512d pz = _mm512_set1_pd(pos[2]);
+    const __m256 one = _mm256_set1_ps(1);
+    __m512d ax = _mm512_setzero_pd();
+    __m512d ay = _mm512_setzero_pd();
+    __m512d az = _mm512_setzero_pd();
+    for(size_t k{0}; k < list.size(); k = k + 8)
+    {
+        __mmask8 lanes;
+        const __m256i idx = loadindices(list, k, lanes);
+        const __m512d dx = _mm512_sub_pd(_mm512_mask_i32gather_pd(px, lanes, idx, src.x.data(), 8), px);
+        const __m512d dy = _mm512_sub_pd(_mm512_mask_i32gather_pd(py, lanes, idx, src.y.data(), 8), py);
+        const __m512d dz = _mm512_sub_pd(_mm512_mask_i32gather_pd(pz, lanes, idx, src.z.data(), 8), pz);
+        const __m256 m = _mm512_maskz_cvtpd_ps(0xff, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), lanes, idx, src.m.data(), 8));
+        //Unused lanes get r2 = 1 so that their (zero mass) contribution stays finite
+        const __m512d r2 = _mm512_mask_fmadd_pd(dx, lanes, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+        const __m256 invr = _mm256_div_ps(one, _mm256_sqrt_ps(_mm512_maskz_cvtpd_ps(0xff, _mm512_mask_blend_pd(lanes, _mm512_set1_pd(1), r2))));
+        const __m512d f = _mm512_maskz_cvtps_pd(0xff, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(m, invr), invr), invr));
+        ax = _mm512_fmadd_pd(f, dx, ax);
+        ay = _mm512_fmadd_pd(f, dy, ay);
+        az = _mm512_fmadd_pd(f, dz, az);
+    }
+    alignas(64) double lanes[3][8];
+    _mm512_store_pd(lanes[0], ax);
+    _mm512_store_pd(lanes[1], ay);
+    _mm512_store_pd(lanes[2], az);
+    array<double,3> acc = {addlanes(lanes[0], 8), addlanes(lanes[1], 8), addlanes(lanes[2], 8)};
+    return(acc);
+}
+#endif
+
+/**
+ * @brief Checks which vector instruction sets the CPU running the program supports
+ * 
+ * @param hasavx2 Set to true if AVX2 and FMA are supported
+ * @param hasavx512 Set to true if AVX-512F is supported
+ */
+void detectsimd(bool &hasavx2, bool &hasavx512)
+{
+    hasavx2 = false;
+    hasavx512 = false;
+#ifdef SIMDKERNELS
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxleaf = info[0];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    if(maxleaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        hasavx2 = fma && (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+        hasavx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    }
+#else
+    __builtin_cpu_init();
+    hasavx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    hasavx512 = __builtin_cpu_supports("avx512f");
+#endif
+#endif
+}
+
+/**
+ * @brief Picks a force kernel by name. "auto" picks the widest kernel the CPU supports. Long double always gets the scalar kernel
+ * 
+ * @param name "auto", "scalar", "avx2" or "avx512"
+ * @return forcekernel<T> The kernel, or NULL if the name is unknown or the kernel is not available for this CPU or precision
+ */
+template <typename T, typename K>
+forcekernel<T> chooseforcekernel(const string &name)
+{
+    bool hasavx2;
+    bool hasavx512;
+    detectsimd(hasavx2, hasavx512);
+    forcekernel<T> avx2{NULL};
+    forcekernel<T> avx512{NULL};
+#ifdef SIMDKERNELS
+    if constexpr(is_same<T,K>::value && (is_same<T,float>::value || is_same<T,double>::value))
+    {
+        avx2 = forcekernelavx2;
+        avx512 = forcekernelavx512;
+    }
+    else if constexpr(is_same<T,double>::value && is_same<K,float>::value)
+    {
+        avx2 = forcekernelavx2mixed;
+        avx512 = forcekernelavx512mixed;
+    }
+#endif
+    if(!hasavx2)
+    {
+        avx2 = NULL;
+    }
+    if(!hasavx512)
+    {
+        avx512 = NULL;
+    }
+    if(name == "avx512")
+    {
+        return(avx512);
+    }
+    if(name == "avx2")
+    {
+        return(avx2);
+    }
+    if(name == "auto" && avx512 != NULL)
+    {
+        return(avx512);
+    }
+    if(name == "auto" && avx2 != NULL)
+    {
+        return(avx2);
+    }
+    if(name == "auto" || name == "scalar")
+    {
+        return(forcekernelscalar<T,K>);
+    }
+    return(NULL);
+}
+
+/**
+ * @brief Computes the accelerations of all leaves of a tree and adds them (times G) to the newacceleration of their bodies
+ * 
+ * @param arena Arena the tree is stored in
+ * @param root Root of the tree
+ * @param threads Threads to use, or NULL
+ * @param openingangle Two nodes interact as a whole when the sum of their radii divided by their distance is less than this
+ * @param usequadrupoles Whether the quadrupoles of the source nodes are used
+ */
+template <typename T>
+void fastmultipole<T>::accelerations(Nodearena<T> &arena, int root, threadpool* threads, double openingangle, bool usequadrupoles)
+{
+    nodes = &arena;
+    pool = threads;
+    theta = openingangle;
+    quadrupoles = usequadrupoles;
+    radius.assign(arena.size(), 0);
+    nearfield.assign(arena.bodies.size(), {0,0,0});
+    field.assign(arena.size(), {0,0,0});
+    gradient.assign(arena.size(), {0,0,0,0,0,0});
+    hessian.assign(quadrupoles ? arena.size() : 0, {0,0,0,0,0,0,0,0,0,0});
+    if(pool != NULL)
+    {
+        taskcutoff = (arena[root].bodyrange[1] - arena[root].bodyrange[0])/(8*pool->size()) + 1;
+    }
+    boundingradius(root);
+    selfinteract(root);
+    downward(root);
+}
+
+/**
+ * @brief Finds the radius of a sphere about the center of gravity of each node that holds all its bodies, bottom-up. The sphere of a leaf is the smallest one, and the sphere of any other node holds the spheres of its children
+ * 
+ * @param node Input node
+ */
+template <typename T>
+void fastmultipole<T>::boundingradius(int node)
+{
+    Nodearena<T> &arena = *nodes;
+    if(arena[node].isleaf)
+    {
+        T largest{0};
+        for(size_t k{arena[node].bodyrange[0]}; k < arena[node].bodyrange[1]; k++)
+        {
+            largest = max(largest, moodulus(arena.bodies[k].position - arena[node].cog));
+        }
+        radius[node] = largest;
+        return;
+    }
+    T largest{0};
+    for(size_t i{0}; i < 8; i++)
+    {
+        const int child = arena[node].Nodelist[i];
+        if(child != nullnode)
+        {
+            boundingradius(child);
+            largest = max(largest, moodulus(arena[child].cog - arena[node].cog) + radius[child]);
+        }
+    }
+    radius[node] = largest;
+}
+
+/**
+ * @brief Does the interactions of a node with itself, like interact(node, node). With a pool, every child of a large node is the sink of a task of its own, so the tasks write to separate local expansions
+ * 
+ * @param node Input node
+ */
+template <typename T>
+void fastmultipole<T>::selfinteract(int node)
+{
+    Nodearena<T> &arena = *nodes;
+    if(pool == NULL || arena[node].bodyrange[1] - arena[node].bodyrange[0] <= taskcutoff)
+    {
+        interact(node, node);
+        return;
+    }
+    atomic<size_t> pending{0};
+    const array<int,8> children = arena[node].Nodelist;
+    for(size_t i{0}; i < 8; i++)
+    {
+        if(children[i] == nullnode)
+        {
+            continue;
+        }
+        pool->submit([this, children, i]()
+        {
+            for(size_t j{0}; j < 8; j++)
+            {
+                if(j == i)
+                {
+                    selfinteract(children[i]);
+                }
+                else if(children[j] != nullnode)
+                {
+                    interact(children[i], children[j]);
+                }
+            }
+        }, pending);
+    }
+    pool->wait(pending);
+}
+
+/**
+ * @brief Dual tree walk: adds the pull of the bodies of source on the bodies of sink to the local expansions under sink. Well separated nodes interact as a whole, leaves that are not interact body by body, and otherwise the larger node is opened
+ * 
+ * @param sink Node pulled on
+ * @param source Node pulling
+ */
+template <typename T>
+void fastmultipole<T>::interact(int sink, int source)
+{
+    Nodearena<T> &arena = *nodes;
+    const Node<T> &a = arena[sink];
+    const Node<T> &b = arena[source];
+    if(sink == source)
+    {
+        if(a.isleaf)
+        {
+            bodytobody(sink, source);
+            return;
+        }
+        for(size_t i{0}; i < 8; i++)
+        {
+            for(size_t j{0}; j < 8; j++)
+            {
+                if(a.Nodelist[i] != nullnode && a.Nodelist[j] != nullnode)
+                {
+                    interact(a.Nodelist[i], a.Nodelist[j]);
+                }
+            }
+        }
+        return;
+    }
+    const bool holdssink = b.bodyrange[0] <= a.bodyrange[0] && a.bodyrange[1] <= b.bodyrange[1];
+    if(!holdssink)
+    {
+        const T distance = moodulus(b.cog - a.cog);
+        if(radius[sink] + radius[source] < theta*distance)
+        {
+            celltocell(sink, source);
+            return;
+        }
+        if(a.isleaf && b.isleaf)
+        {
+            bodytobody(sink, source);
+            return;
+        }
+    }
+    if(!b.isleaf && (holdssink || a.isleaf || radius[source] >= radius[sink]))
+    {
+        for(size_t j{0}; j < 8; j++)
+        {
+            if(b.Nodelist[j] != nullnode)
+            {
+                interact(sink, b.Nodelist[j]);
+            }
+        }
+    }
+    else
+    {
+        for(size_t i{0}; i < 8; i++)
+        {
+            if(a.Nodelist[i] != nullnode)
+            {
+                interact(a.Nodelist[i], source);
+            }
+        }
+    }
+}
+
+/**
+ * @brief M2L: adds the pull of source, as a mass at its center of gravity (plus its quadrupole, if used), to the local expansion of sink about its center of gravity
+ * 
+ * @param sink Node pulled on
+ * @param source Node pulling
+ */
+template <typename T>
+void fastmultipole<T>::celltocell(int sink, int source)
+{
+    Nodearena<T> &arena = *nodes;
+    const Node<T> &a = arena[sink];
+    const Node<T> &b = arena[source];
+    const bool sinkbodies = a.bodyrange[1] - a.bodyrange[0] > 1;
+    const bool sourcebodies = b.bodyrange[1] - b.bodyrange[0] > 1;
+    const array<T,3> r = b.cog - a.cog;
+    const T invr = 1/sqrt(r*r);
+    const array<T,3> u = invr*r;
+    const T f = ((b.cogmass*invr)*invr)*invr;
+    field[sink] = field[sink] + f*r;
+    if(quadrupoles && sourcebodies)
+    {
+        const array<T,6> &q = b.quadrupole;
+        const array<T,3> qu = {((q[0]*invr)*invr)*u[0] + ((q[1]*invr)*invr)*u[1] + ((q[2]*invr)*invr)*u[2],
+                               ((q[1]*invr)*invr)*u[0] + ((q[3]*invr)*invr)*u[1] + ((q[4]*invr)*invr)*u[2],
+                               ((q[2]*invr)*invr)*u[0] + ((q[4]*invr)*invr)*u[1] + ((q[5]*invr)*invr)*u[2]};
+        const T uqu = u*qu;
+        field[sink] = field[sink] + ((b.cogmass*invr)*invr)*((T) 2.5*uqu*u - qu);
+    }
+    if(sinkbodies)
+    {
+        array<T,6> &g = gradient[sink];
+        g[0] = g[0] + f*(3*u[0]*u[0] - 1);
+        g[1] = g[1] + f*(3*u[0]*u[1]);
+        g[2] = g[2] + f*(3*u[0]*u[2]);
+        g[3] = g[3] + f*(3*u[1]*u[1] - 1);
+        g[4] = g[4] + f*(3*u[1]*u[2]);
+        g[5] = g[5] + f*(3*u[2]*u[2] - 1);
+    }
+    if(quadrupoles && sinkbodies)
+    {
+        //m*(15*u_i*u_j*u_k - 3*(d_ij*u_k + d_ik*u_j + d_jk*u_i))/|r|^4, in the order xxx, xxy, xxz, xyy, xyz, xzz, yyy, yyz, yzz, zzz
+        const T h = f*invr;
+        const array<array<size_t,3>,10> indices = {{{0,0,0},{0,0,1},{0,0,2},{0,1,1},{0,1,2},{0,2,2},{1,1,1},{1,1,2},{1,2,2},{2,2,2}}};
+        array<T,10> &hess = hessian[sink];
+        for(size_t c{0}; c < 10; c++)
+        {
+            const size_t i = indices[c][0];
+            const size_t j = indices[c][1];
+            const size_t k = indices[c][2];
+            T deltas{0};
+            deltas = deltas + ((i == j) ? u[k] : 0);
+            deltas = deltas + ((i == k) ? u[j] : 0);
+            deltas = deltas + ((j == k) ? u[i] : 0);
+            hess[c] = hess[c] + h*(15*u[i]*u[j]*u[k] - 3*deltas);
+        }
+    }
+}
+
+/**
+ * @brief P2P: adds the pull of every body of the leaf source on every body of the leaf sink to nearfield, summed directly. Pairs of bodies at the same position (a body and itself, when sink is source) are skipped
+ * 
+ * @param sink Leaf pulled on
+ * @param source Leaf pulling
+ */
+template <typename T>
+void fastmultipole<T>::bodytobody(int sink, int source)
+{
+    Nodearena<T> &arena = *nodes;
+    const vector<body<T>> &bodies = arena.bodies;
+    for(size_t i{arena[sink].bodyrange[0]}; i < arena[sink].bodyrange[1]; i++)
+    {
+        array<T,3> acc = nearfield[i];
+        for(size_t j{arena[source].bodyrange[0]}; j < arena[source].bodyrange[1]; j++)
+        {
+            const array<T,3> r = bodies[j].position - bodies[i].position;
+            const T r2 = r*r;
+            if(r2 > 0)
+            {
+                const T invr = 1/sqrt(r2);
+                acc = acc + (((bodies[j].mass*invr)*invr)*invr)*r;
+            }
+        }
+        nearfield[i] = acc;
+    }
+}
+
+/**
+ * @brief L2L and L2P: shifts the local expansion of node to the centers of gravity of its children, down to the leaves, where it is added to the acceleration of each body with nearfield. The children of large nodes are done as parallel tasks if there is a pool
+ * 
+ * @param node Input node
+ */
+template <typename T>
+void fastmultipole<T>::downward(int node)
+{
+    Nodearena<T> &arena = *nodes;
+    const array<T,6> &g = gradient[node];
+    if(arena[node].isleaf)
+    {
+        for(size_t k{arena[node].bodyrange[0]}; k < arena[node].bodyrange[1]; k++)
+        {
+            body<T> &b = arena.bodies[k];
+            const array<T,3> d = b.position - arena[node].cog;
+            array<T,3> local = {g[0]*d[0] + g[1]*d[1] + g[2]*d[2],
+                                g[1]*d[0] + g[3]*d[1] + g[4]*d[2],
+                                g[2]*d[0] + g[4]*d[1] + g[5]*d[2]};
+            local = field[node] + local;
+            if(quadrupoles)
+            {
+                const array<T,10> &hess = hessian[node];
+                const array<T,6> dd = {d[0]*d[0], d[0]*d[1], d[0]*d[2], d[1]*d[1], d[1]*d[2], d[2]*d[2]};
+                const array<T,3> curvature = {hess[0]*dd[0] + 2*hess[1]*dd[1] + 2*hess[2]*dd[2] + hess[3]*dd[3] + 2*hess[4]*dd[4] + hess[5]*dd[5],
+                                              hess[1]*dd[0] + 2*hess[3]*dd[1] + 2*hess[4]*dd[2] + hess[6]*dd[3] + 2*hess[7]*dd[4] + hess[8]*dd[5],
+                                              hess[2]*dd[0] + 2*hess[4]*dd[1] + 2*hess[5]*dd[2] + hess[7]*dd[3] + 2*hess[8]*dd[4] + hess[9]*dd[5]};
+                local = local + (T) 0.5*curvature;
+            }
+            b.newacceleration = b.newacceleration + (T) G*(local + nearfield[k]);
+        }
+        return;
+    }
+    const bool parallel = pool != NULL && arena[node].bodyrange[1] - arena[node].bodyrange[0] > taskcutoff;
+    atomic<size_t> pending{0};
+    for(size_t i{0}; i < 8; i++)
+    {
+        const int child = arena[node].Nodelist[i];
+        if(child == nullnode)
+        {
+            continue;
+        }
+        const array<T,3> d = arena[child].cog - arena[node].cog;
+        const array<T,3> shifted = {g[0]*d[0] + g[1]*d[1] + g[2]*d[2],
+                                    g[1]*d[0] + g[3]*d[1] + g[4]*d[2],
+                                    g[2]*d[0] + g[4]*d[1] + g[5]*d[2]};
+        field[child] = field[child] + field[node] + shifted;
+        gradient[child] = gradient[child] + g;
+        if(quadrupoles)
+        {
+            //The second derivatives add (1/2)*H:dd to the acceleration and H.d to its gradient
+            const array<T,10> &hess = hessian[node];
+            const array<T,6> dd = {d[0]*d[0], d[0]*d[1], d[0]*d[2], d[1]*d[1], d[1]*d[2], d[2]*d[2]};
+            const array<T,3> curvature = {hess[0]*dd[0] + 2*hess[1]*dd[1] + 2*hess[2]*dd[2] + hess[3]*dd[3] + 2*hess[4]*dd[4] + hess[5]*dd[5],
+                                          hess[1]*dd[0] + 2*hess[3]*dd[1] + 2*hess[4]*dd[2] + hess[6]*dd[3] + 2*hess[7]*dd[4] + hess[8]*dd[5],
+                                          hess[2]*dd[0] + 2*hess[4]*dd[1] + 2*hess[5]*dd[2] + hess[7]*dd[3] + 2*hess[8]*dd[4] + hess[9]*dd[5]};
+            field[child] = field[child] + (T) 0.5*curvature;
+            const array<T,6> slope = {hess[0]*d[0] + hess[1]*d[1] + hess[2]*d[2],
+                                      hess[1]*d[0] + hess[3]*d[1] + hess[4]*d[2],
+                                      hess[2]*d[0] + hess[4]*d[1] + hess[5]*d[2],
+                                      hess[3]*d[0] + hess[6]*d[1] + hess[7]*d[2],
+                                      hess[4]*d[0] + hess[7]*d[1] + hess[8]*d[2],
+                                      hess[5]*d[0] + hess[8]*d[1] + hess[9]*d[2]};
+            gradient[child] = gradient[child] + slope;
+            hessian[child] = hessian[child] + hess;
+        }
+        if(parallel)
+        {
+            pool->submit([this, child](){ downward(child); }, pending);
+        }
+        else
+        {
+            downward(child);
+        }
+    }
+    if(parallel)
+    {
+        pool->wait(pending);
+    }
+}
+
+/**
+ * @brief Hands out the next unused node. The storage only grows when more nodes are needed than in any earlier tree, so the node that is returned may hold stale data from a previous timestep and has to be filled in completely
+ * 
+ * @return int Index of the node
+ */
+template <typename T>
+int Nodearena<T>::allocate()
+{
+    if(used == nodes.size())
+    {
+        nodes.emplace_back();
+    }
+    used = used + 1;
+    return((int) used - 1);
+}
+
+/**
+ * @brief Throws away all nodes at once. The storage is kept so that the next tree can reuse it
+ * 
+ */
+template <typename T>
+void Nodearena<T>::reset()
+{
+    used = 0;
+}
+
+/**
+ * @brief Number of nodes handed out since the last reset
+ * 
+ * @return size_t 
+ */
+template <typename T>
+size_t Nodearena<T>::size()
+{
+    return(used);
+}
+
+/**
+ * @brief Appends all nodes of another arena to this one, shifting their child indices to match. The root of the other arena has to be its first node
+ * 
+ * @param other Arena to copy the nodes from
+ * @return int Index of the root of other in this arena
+ */
+template <typename T>
+int Nodearena<T>::splice(Nodearena<T> &other)
+{
+    const int offset = (int) used;
+    for(size_t k{0}; k < other.used; k++)
+    {
+        int dest = allocate();
+        nodes[dest] = other.nodes[k];
+        for(size_t i{0}; i < 8; i++)
+        {
+            if(nodes[dest].Nodelist[i] != nullnode)
+            {
+                nodes[dest].Nodelist[i] = nodes[dest].Nodelist[i] + offset;
+            }
+        }
+    }
+    return(offset);
+}
+
+/**
+ * @brief Moves the nodes into a new order, fixing up their child indices. Nodes that are not in order are thrown away
+ * 
+ * @param order Old index of every node, in the new order
+ */
+template <typename T>
+void Nodearena<T>::reorder(const vector<int> &order)
+{
+    newindex.assign(used, nullnode);
+    for(size_t k{0}; k < order.size(); k++)
+    {
+        newindex[order[k]] = (int) k;
+    }
+    reordered.resize(order.size());
+    for(size_t k{0}; k < order.size(); k++)
+    {
+        reordered[k] = nodes[order[k]];
+        for(size_t i{0}; i < 8; i++)
+        {
+            if(reordered[k].Nodelist[i] != nullnode)
+            {
+                reordered[k].Nodelist[i] = newindex[reordered[k].Nodelist[i]];
+            }
+        }
+    }
+    nodes.swap(reordered);
+    used = order.size();
+}
+
+/**
+ * @brief Lends out an empty spare arena, to build part of a tree in on another thread. Spare arenas are kept, so their storage is reused as well. Safe to call from several threads at once
+ * 
+ * @return Nodearena<T>& 
+ */
+template <typename T>
+Nodearena<T>& Nodearena<T>::borrow()
+{
+    lock_guard<mutex> guard(spareslock);
+    if(freespares.empty())
+    {
+        spares.push_back(make_unique<Nodearena<T>>());
+        freespares.push_back(spares.back().get());
+    }
+    Nodearena<T>* spare = freespares.back();
+    freespares.pop_back();
+    spare->reset();
+    return(*spare);
+}
+
+/**
+ * @brief Returns a spare arena lent out by borrow
+ * 
+ * @param spare 
+ */
+template <typename T>
+void Nodearena<T>::giveback(Nodearena<T> &spare)
+{
+    lock_guard<mutex> guard(spareslock);
+    freespares.push_back(&spare);
+}
+
+/**
+ * @brief Appends the bytes held by each store of the arena to sizes: its nodes and bodies (used or not), reordered, newindex, its buffers and its spare arenas. Not safe to call while a tree is being built
+ * 
+ * @param sizes Output, one entry per store
+ */
+template <typename T>
+void Nodearena<T>::capacities(vector<size_t> &sizes)
+{
+    sizes.push_back(nodes.capacity()*sizeof(Node<T>));
+    sizes.push_back(reordered.capacity()*sizeof(Node<T>));
+    sizes.push_back(bodies.capacity()*sizeof(body<T>));
+    sizes.push_back(newindex.capacity()*sizeof(int));
+    sizes.push_back(spares.capacity()*sizeof(unique_ptr<Nodearena>) + freespares.capacity()*sizeof(Nodearena*));
+    buffers.capacities(sizes);
+    for(size_t i{0}; i < spares.size(); i++)
+    {
+        spares[i]->capacities(sizes);
+    }
+}
+
+/**
+ * @brief Appends the bytes held by each buffer, used or not, to sizes
+ * 
+ * @param sizes Output, one entry per buffer
+ */
+template <typename T>
+void buildbuffers<T>::capacities(vector<size_t> &sizes)
+{
+    for(vector<unsigned long long>* buffer : {&mortonkeys, &keys, &tempkeys})
+    {
+        sizes.push_back(buffer->capacity()*sizeof(unsigned long long));
+    }
+    for(vector<size_t>* buffer : {&order, &temporder, &counts})
+    {
+        sizes.push_back(buffer->capacity()*sizeof(size_t));
+    }
+    for(vector<body<T>>* buffer : {&extras, &laidout, &migrants})
+    {
+        sizes.push_back(buffer->capacity()*sizeof(body<T>));
+    }
+    for(vector<int>* buffer : {&firstextra, &nextextra, &layoutorder, &pending})
+    {
+        sizes.push_back(buffer->capacity()*sizeof(int));
+    }
+    sizes.push_back(maxrads.capacity()*sizeof(T));
+    sizes.push_back(grid.bytes());
+}
+
+/**
+ * @brief Access to a node by its index. References are invalidated by allocate, so they should not be held on to while building
+ * 
+ * @param i Index of the node
+ * @return Node& 
+ */
+template <typename T>
+Node<T>& Nodearena<T>::operator[](int i)
+{
+    return(nodes[i]);
+}
+
+/**
+ * @brief Index of the deque owned by the current thread in its threadpool. Worker threads set this when they start, any other thread (such as the one that made the pool) uses deque 0
+ * 
+ */
+thread_local size_t ownqueue{0};
+
+/**
+ * @brief Construct a new threadpool::threadpool object. One deque is made per thread, and nthreads - 1 worker threads are started since the calling thread also runs tasks
+ * 
+ * @param nthreads Total number of threads, including the calling thread
+ */
+threadpool::threadpool(size_t nthreads)
+{
+    if(nthreads == 0)
+    {
+        nthreads = 1;
+    }
+    for(size_t i{0}; i < nthreads; i++)
+    {
+        queues.push_back(make_unique<taskqueue>());
+    }
+    for(size_t i{1}; i < nthreads; i++)
+    {
+        workers.emplace_back(&threadpool::workerloop, this, i);
+    }
+}
+
+/**
+ * @brief Destroy the threadpool::threadpool object. Wakes all workers and waits for them to finish
+ * 
+ */
+threadpool::~threadpool()
+{
+    {
+        lock_guard<mutex> guard(sleeplock);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for(size_t i{0}; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+
+/**
+ * @brief Number of threads in the pool, including the thread that made it
+ * 
+ * @return size_t 
+ */
+size_t threadpool::size()
+{
+    return(queues.size());
+}
+
+/**
+ * @brief Pushes a task onto the back of the calling thread's deque. pending is incremented now and decremented once the task has run, so that it can be waited on with wait
+ * 
+ * @param task The task to run
+ * @param pending Counter of unfinished tasks
+ */
+void threadpool::submit(function<void()> task, atomic<size_t> &pending)
+{
+    pending++;
+    taskqueue &own = *queues[ownqueue];
+    {
+        lock_guard<mutex> guard(own.lock);
+        own.tasks.push_back([task = move(task), &pending]() { task(); pending--; });
+    }
+    {
+        lock_guard<mutex> guard(sleeplock);
+        queued++;
+    }
+    wakeup.notify_one();
+}
+
+/**
+ * @brief Runs a single task, if there is one. The thread's own deque is tried first (newest task first), then the other deques are stolen from (oldest task first)
+ * 
+ * @param self Index of the deque owned by the calling thread
+ * @return true if a task was run
+ * @return false if all deques were empty
+ */
+bool threadpool::runtask(size_t self)
+{
+    function<void()> task;
+    for(size_t k{0}; k < queues.size() && !task; k++)
+    {
+        taskqueue &victim = *queues[(self + k) % queues.size()];
+        lock_guard<mutex> guard(victim.lock);
+        if(victim.tasks.empty())
+        {
+            continue;
+        }
+        if(k == 0)
+        {
+            task = move(victim.tasks.back());
+            victim.tasks.pop_back();
+        }
+        else
+        {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if(!task)
+    {
+        return(false);
+    }
+    queued--;
+    task();
+    return(true);
+}
+
+/**
+ * @brief The loop run by every worker thread. Runs or steals tasks until there are none left, then sleeps until more are submitted
+ * 
+ * @param self Index of the deque owned by this worker
+ */
+void threadpool::workerloop(size_t self)
+{
+    ownqueue = self;
+    while(true)
+    {
+        if(runtask(self))
+        {
+            continue;
+        }
+        unique_lock<mutex> guard(sleeplock);
+        wakeup.wait(guard, [this]() { return(queued > 0 || stopping); });
+        if(stopping && queued == 0)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Waits until pending drops to zero. Instead of blocking, the calling thread runs tasks itself in the meantime, so tasks may submit and wait on more tasks without deadlocking
+ * 
+ * @param pending Counter of unfinished tasks given to submit
+ */
+void threadpool::wait(atomic<size_t> &pending)
+{
+    while(pending > 0)
+    {
+        if(!runtask(ownqueue))
+        {
+            this_thread::yield();
+        }
+    }
+}
+
+/**
+ * @brief Splits [0, n) into chunks of at most grain elements, runs f(begin, end) on every chunk in the pool and waits for all of them
+ * 
+ * @param n Number of elements
+ * @param grain Maximum number of elements per task
+ * @param f Function run on each chunk
+ */
+void threadpool::parallelfor(size_t n, size_t grain, const function<void(size_t, size_t)> &f)
+{
+    atomic<size_t> pending{0};
+    if(grain == 0)
+    {
+        grain = 1;
+    }
+    for(size_t begin{0}; begin < n; begin = begin + grain)
+    {
+        size_t end = min(n, begin + grain);
+        submit([&f, begin, end]() { f(begin, end); }, pending);
+    }
+    wait(pending);
+}
+
+/**
+ * @brief Makes the drifts and kicks of an integrator from the weights w_i of its leapfrog steps, sharing the drift between two steps in a row: the drifts are w_0/2, (w_0 + w_1)/2, ..., w_n/2 and the kicks are the weights
+ * 
+ * @param name "leapfrog", "forestruth" or "yoshida6". Anything else is taken as leapfrog
+ */
+integrator::integrator(const string &name)
+{
+    vector<long double> weights{1};
+    if(name == "forestruth")
+    {
+        const long double theta = 1/(2 - cbrtl(2));
+        weights = {theta, 1 - 2*theta, theta};
+    }
+    else if(name == "yoshida6")
+    {
+        //Solution A of Yoshida (1990)
+        const long double w1{-1.17767998417887100695L};
+        const long double w2{0.235573213359358133684L};
+        const long double w3{0.784513610477557263819L};
+        const long double w0 = 1 - 2*(w1 + w2 + w3);
+        weights = {w3, w2, w1, w0, w1, w2, w3};
+    }
+    kicks = weights;
+    drifts.assign(weights.size() + 1, 0);
+    for(size_t i{0}; i < weights.size(); i++)
+    {
+        drifts[i] = drifts[i] + weights[i]/2;
+        drifts[i + 1] = drifts[i + 1] + weights[i]/2;
+    }
+}
+
+/**
+ * @brief Sets every counter back to 0 for a new timestep
+ * 
+ */
+void stepstats::clear()
+{
+    bounds = 0;
+    build = 0;
+    force = 0;
+    write = 0;
+    for(atomic<unsigned long long>* counter : {&allocated, &collisionchecks, &lists, &visits, &interactions, &maxvisits, &maxinteractions})
+    {
+        counter->store(0, memory_order_relaxed);
+    }
+    collide.store(0, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts one interaction list. Safe to call from several threads at once
+ * 
+ * @param listvisits Nodes visited to make the list
+ * @param listinteractions Nodes and bodies on the list
+ * @param listbytes Bytes the list had to be reallocated to while it was made, 0 if it fit
+ */
+void stepstats::addlist(size_t listvisits, size_t listinteractions, size_t listbytes)
+{
+    lists.fetch_add(1, memory_order_relaxed);
+    allocated.fetch_add(listbytes, memory_order_relaxed);
+    visits.fetch_add(listvisits, memory_order_relaxed);
+    interactions.fetch_add(listinteractions, memory_order_relaxed);
+    unsigned long long most = maxvisits.load(memory_order_relaxed);
+    while(listvisits > most && !maxvisits.compare_exchange_weak(most, listvisits, memory_order_relaxed)) {}
+    most = maxinteractions.load(memory_order_relaxed);
+    while(listinteractions > most && !maxinteractions.compare_exchange_weak(most, listinteractions, memory_order_relaxed)) {}
+}
+
+/**
+ * @brief Counts the collision checks of one range of bodies. Safe to call from several threads at once
+ * 
+ * @param checks Pairs of bodies checked
+ * @param nanoseconds Time taken
+ */
+void stepstats::addcollisions(size_t checks, long long nanoseconds)
+{
+    collisionchecks.fetch_add(checks, memory_order_relaxed);
+    collide.fetch_add(nanoseconds, memory_order_relaxed);
+}
+
+/**
+ * @brief Construct a new Spacetree:: Spacetree object
+ * 
+ * @param inputreg Initializes private member regi to this
+ * @param inputarena Initializes private member arena to this. The nodes of the tree are stored here
+ * @param inputpool Initializes private member pool to this. Threads used to build the octants in parallel, or NULL to build serially
+ * @param cutoff Initializes private member buildcutoff to this
+ * @param bucket Initializes private member leafsize to this
+ * @param inputstats Initializes private member stats to this. Counts the collision checks, or NULL to count nothing
+ * @param inputcollisions What colliding bodies do: "elastic", "merge" or "none". Sets checkcollisions and merge
+ */
+template <typename T>
+Spacetree<T>::Spacetree(region<T> inputreg, Nodearena<T> &inputarena, threadpool* inputpool, size_t cutoff, size_t bucket, stepstats* inputstats, const string &inputcollisions)
+    : regi{inputreg}, arena{inputarena}, pool{inputpool}, buildcutoff{cutoff}, leafsize{max(bucket, (size_t) 1)}, mortonkeys{inputarena.buffers.mortonkeys}, maxrads{inputarena.buffers.maxrads},
+      extras{inputarena.buffers.extras}, firstextra{inputarena.buffers.firstextra}, nextextra{inputarena.buffers.nextextra}, laidout{inputarena.buffers.laidout}, stats{inputstats},
+      checkcollisions{inputcollisions != "none"}, merge{inputcollisions == "merge"} {}
+
+/**
+ * @brief Makes a tree given the input region regi. The bodies are sorted by Morton key into the bodies of arena first, so makeatree only has to split contiguous ranges of bodies. Any tree previously stored in arena is thrown away
+ * 
+ * @return int returns the index of the root node in arena
+ */
+template <typename T>
+int Spacetree<T>::treegen()
+{
+    arena.reset();
+    regi.checkcol = false;
+    sortbodies();
+    int root = makeatree(arena, 0, arena.bodies.size(), 0, regi.checkcol);
+    return(layout(root));
+}
+
+/**
+ * @brief Stores the nodes of the tree rooted at root in depth first order, children in octant order, and sets the next index of every node, so the tree can be walked in one loop (see Node). The leaves come out in the order of the Morton sorted bodies
+ * 
+ * @param root Root of the tree in arena
+ * @return int The new index of root, which is 0
+ */
+template <typename T>
+int Spacetree<T>::layout(int root)
+{
+    vector<int> &order = arena.buffers.layoutorder;
+    vector<int> &pending = arena.buffers.pending;
+    order.clear();
+    pending.assign(1, root);
+    while(!pending.empty())
+    {
+        const int node = pending.back();
+        pending.pop_back();
+        order.push_back(node);
+        if(!arena[node].isleaf)
+        {
+            for(size_t i{8}; i > 0; i--)
+            {
+                if(arena[node].Nodelist[i-1] != nullnode)
+                {
+                    pending.push_back(arena[node].Nodelist[i-1]);
+                }
+            }
+        }
+    }
+    bool inorder = order.size() == arena.size();
+    for(size_t k{0}; k < order.size() && inorder; k++)
+    {
+        inorder = order[k] == (int) k;
+    }
+    if(!inorder)
+    {
+        arena.reorder(order);
+    }
+    //Bottom-up, so the next index of the last child of a node is known before the node itself
+    for(int node{(int) order.size() - 1}; node >= 0; node--)
+    {
+        Node<T> &current = arena[node];
+        current.next = node + 1;
+        for(size_t i{8}; i > 0 && !current.isleaf; i--)
+        {
+            if(current.Nodelist[i-1] != nullnode)
+            {
+                current.next = arena[current.Nodelist[i-1]].next;
+                break;
+            }
+        }
+    }
+    return(0);
+}
+
+/**
+ * @brief Adds null nodes to a leaf node via a simple loop through all nodes the leaf node leads to
+ * 
+ * @param nodes Arena the leaf node is stored in
+ * @param newnode Input leaf node
+ * @return int Returns the leaf node
+ */
+template <typename T>
+int Spacetree<T>::addnulls(Nodearena<T> &nodes, int newnode)
+{
+    for(size_t i{0}; i < 8; i++)
+    {
+        nodes[newnode].Nodelist[i] = nullnode;
+    }
+    return(newnode);
+} 
+
+/**
+ * @brief Updates the velocities of all bodies in a range of the bodies of arena if there are collisions. Two bodies will elastically collide if the distance between them is less than the sum of their radii, or merge with merge set. The checks and their time are added to stats, if there is one
+ * 
+ * @param grid Collision grid to use, that of the arena the calling thread builds its nodes in
+ * @param first Index of the first body of the range
+ * @param last One past the index of the last body of the range
+ */
+template <typename T>
+void Spacetree<T>::updatecollision(collisiongrid<T> &grid, size_t first, size_t last)
+{
+    if(!checkcollisions)
+    {
+        return;
+    }
+    if(stats == NULL)
+    {
+        grid.collide(arena.bodies, first, last, merge);
+        return;
+    }
+    chrono::time_point start{chrono::steady_clock::now()};
+    const size_t checks = grid.collide(arena.bodies, first, last, merge);
+    const long long nanoseconds = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    stats->addcollisions(checks, nanoseconds);
+}
+
+/**
+ * @brief Adds the quadrupole moment of a point mass to a quadrupole (stored as xx, xy, xz, yy, yz, zz)
+ * 
+ * @param quadrupole Quadrupole to add to
+ * @param weight Mass of the point mass, divided by the mass of the node the quadrupole is of
+ * @param r Position of the point mass relative to the center of gravity of the node
+ */
+template <typename T>
+void addquadrupole(array<T,6> &quadrupole, T weight, const array<T,3> &r)
+{
+    const T r2 = r*r;
+    quadrupole[0] = quadrupole[0] + weight*(3*r[0]*r[0] - r2);
+    quadrupole[1] = quadrupole[1] + weight*(3*r[0]*r[1]);
+    quadrupole[2] = quadrupole[2] + weight*(3*r[0]*r[2]);
+    quadrupole[3] = quadrupole[3] + weight*(3*r[1]*r[1] - r2);
+    quadrupole[4] = quadrupole[4] + weight*(3*r[1]*r[2]);
+    quadrupole[5] = quadrupole[5] + weight*(3*r[2]*r[2] - r2);
+}
+
+/**
+ * @brief Spreads the lowest 21 bits of an integer out so that there are two zero bits between each of them. Three spread integers can then be interleaved into a Morton key with shifts and ors
+ * 
+ * @param v Input integer
+ * @return unsigned long long 
+ */
+unsigned long long spreadbits(unsigned long long v)
+{
+    v = v & 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return(v);
+}
+
+/**
+ * @brief Computes the Morton key of a body: its cell in [0, 2^21) along each axis of regi, with the bits interleaved so that the three bits of each level give its octant in Nodelist
+ * 
+ * @param b Input body
+ * @return unsigned long long 
+ */
+template <typename T>
+unsigned long long Spacetree<T>::mortonkey(const body<T> &b)
+{
+    const array<array<T, 2>, 3> ranges = {regi.xrange, regi.yrange, regi.zrange};
+    const T cells = (T) (1ULL << mortonlevels);
+    unsigned long long key{0};
+    for(size_t k{0}; k < 3; k++)
+    {
+        T scaled = cells*(b.position[k] - ranges[k][0])/(ranges[k][1] - ranges[k][0]);
+        unsigned long long cell{0};
+        if(scaled >= cells)
+        {
+            cell = (1ULL << mortonlevels) - 1;
+        }
+        else if(scaled > 0)
+        {
+            cell = (unsigned long long) scaled;
+        }
+        key = key | (spreadbits(cell) << k);
+    }
+    return(key);
+}
+
+/**
+ * @brief Sorts the bodies of arena by Morton key with a least significant digit radix sort of the keys and an index permutation, then permutes the bodies in place one cycle at a time. The sorted keys are kept in mortonkeys
+ * 
+ */
+template <typename T>
+void Spacetree<T>::sortbodies()
+{
+    vector<body<T>> &bodies = arena.bodies;
+    const size_t n = bodies.size();
+    const size_t radixbits{9};
+    const size_t buckets = 1 << radixbits;
+    vector<unsigned long long> &keys = arena.buffers.keys;
+    vector<unsigned long long> &tempkeys = arena.buffers.tempkeys;
+    vector<size_t> &order = arena.buffers.order;
+    vector<size_t> &temporder = arena.buffers.temporder;
+    vector<size_t> &counts = arena.buffers.counts;
+    keys.resize(n);
+    tempkeys.resize(n);
+    order.resize(n);
+    temporder.resize(n);
+    for(size_t i{0}; i < n; i++)
+    {
+        keys[i] = mortonkey(bodies[i]);
+        order[i] = i;
+    }
+    for(size_t shift{0}; shift < 3*mortonlevels; shift = shift + radixbits)
+    {
+        counts.assign(buckets + 1, 0);
+        for(size_t i{0}; i < n; i++)
+        {
+            counts[((keys[i] >> shift) & (buckets - 1)) + 1]++;
+        }
+        for(size_t b{0}; b < buckets; b++)
+        {
+            counts[b + 1] = counts[b + 1] + counts[b];
+        }
+        for(size_t i{0}; i < n; i++)
+        {
+            size_t dest = counts[(keys[i] >> shift) & (buckets - 1)]++;
+            tempkeys[dest] = keys[i];
+            temporder[dest] = order[i];
+        }
+        keys.swap(tempkeys);
+        order.swap(temporder);
+    }
+    //Body i goes to where order says, and order[i] is set to i once it is in place
+    for(size_t i{0}; i < n; i++)
+    {
+        if(order[i] == i)
+        {
+            continue;
+        }
+        const body<T> first = bodies[i];
+        size_t j = i;
+        while(true)
+        {
+            const size_t from = order[j];
+            order[j] = j;
+            if(from == i)
+            {
+                bodies[j] = first;
+                break;
+            }
+            bodies[j] = bodies[from];
+            j = from;
+        }
+    }
+    mortonkeys.swap(keys);
+}
+
+/**
+ * @brief Sets the mass, center of gravity, extent and quadrupole of a node from a range of bodies. The extent is twice the mean distance of the bodies from the center of gravity
+ * 
+ * @param node Node to fill in
+ * @param bodies Bodies the range is in
+ * @param first Index of the first body of the range
+ * @param last One past the index of the last body of the range
+ * @return T The largest radius of the bodies
+ */
+template <typename T>
+T Spacetree<T>::setmoments(Node<T> &node, const vector<body<T>> &bodies, size_t first, size_t last)
+{
+    T totmass{0};
+    T extent{0};
+    array<T, 3> tempcog = {0,0,0};
+    T maxrad{0};
+    for(size_t h{first}; h < last; h++)
+    {
+        totmass = totmass + bodies[h].mass;
+        if(bodies[h].radius > maxrad)
+        {
+            maxrad = bodies[h].radius;
+        }      
+    }
+    for(size_t hh{first}; hh < last; hh++)
+    {
+        tempcog = tempcog + ((bodies[hh].mass)/(totmass))*bodies[hh].position;
+    }
+    array<T, 6> quadrupole = {0,0,0,0,0,0};
+    for(size_t hhh{first}; hhh < last; hhh++)
+    {
+        const array<T, 3> r = bodies[hhh].position - tempcog;
+        extent = extent + moodulus(r);
+        addquadrupole(quadrupole, (bodies[hhh].mass)/(totmass), r);
+    }
+    
+    node.cogmass = totmass;
+    node.cog = tempcog;
+    node.quadrupole = quadrupole;
+    node.extent = 2*extent/(last - first);
+    return(maxrad);
+}
+
+/**
+ * @brief Recursively makes a tree from a range of the Morton sorted bodies. The moments of the range are stored in the current node, and ranges of more than leafsize bodies are split into their eight octants by a binary search on the key bits of this level. Collisions are also updated here, but only if the extent of a region is 10 times the maximum radius of all bodies in that region.
+ * If there is a pool and the range has more than buildcutoff bodies, the octants are built as parallel tasks. The octants cover disjoint ranges of bodies, so collisions inside them do not depend on the order the tasks run in
+ * 
+ * @param nodes Arena the nodes are stored in
+ * @param first Index of the first body in the bodies of arena covered by this node
+ * @param last One past the index of the last body covered by this node
+ * @param level Depth of this node in the tree (0 for the root)
+ * @param checkcol Whether collisions have already been computed for these bodies
+ * @return int Returns the index of the node in nodes
+ */
+template <typename T>
+int Spacetree<T>::makeatree(Nodearena<T> &nodes, size_t first, size_t last, size_t level, bool checkcol)
+{
+    int pointer = nodes.allocate();
+    nodes[pointer].bodyrange = {first, last};
+    if(last - first == 1)
+    {
+        pointer = addnulls(nodes, pointer);
+        Node<T> &leaf = nodes[pointer];
+        const body<T> &solebody = arena.bodies[first];
+        leaf.isleaf = true;
+        leaf.cog = solebody.position;
+        leaf.cogmass = solebody.mass;
+        leaf.extent = 0;
+        leaf.quadrupole = {0,0,0,0,0,0};
+        return(pointer);
+    }
+    const T maxrad = setmoments(nodes[pointer], arena.bodies, first, last);
+    const T extent = nodes[pointer].extent;
+
+    if(extent < 10*maxrad && !checkcol)
+    {
+        updatecollision(nodes.buffers.grid, first, last);
+        checkcol = true;
+    }
+
+    if(last - first <= leafsize)
+    {
+        pointer = addnulls(nodes, pointer);
+        nodes[pointer].isleaf = true;
+        return(pointer);
+    }
+    nodes[pointer].isleaf = false;
+
+    array<size_t,9> bounds;
+    bounds[0] = first;
+    bounds[8] = last;
+    if(level < mortonlevels)
+    {
+        const size_t shift = 3*(mortonlevels - 1 - level);
+        for(size_t i{1}; i < 8; i++)
+        {
+            auto inlowerocts = [shift, i](unsigned long long key){ return(((key >> shift) & 7) < i); };
+            bounds[i] = partition_point(mortonkeys.begin() + bounds[i-1], mortonkeys.begin() + last, inlowerocts) - mortonkeys.begin();
+        }
+    }
+    else
+    {
+        //The keys have run out of bits, so the remaining bodies share the same smallest cell. Deal them out into eight contiguous chunks instead
+        for(size_t i{1}; i < 8; i++)
+        {
+            bounds[i] = first + ((last - first)*i)/8;
+        }
+    }
+
+    if(pool != NULL && last - first > buildcutoff)
+    {
+        //Every child is built into its own spare arena as a task on the pool. They are spliced back in octant order once all of them are done, so the tree comes out the same no matter which thread finished first
+        array<Nodearena<T>*,8> childarenas;
+        childarenas.fill(NULL);
+        atomic<size_t> pending{0};
+        for(size_t i{0}; i < 8; i++)
+        {
+            if(bounds[i+1] == bounds[i])
+            {
+                continue;
+            }
+            Nodearena<T> &childarena = arena.borrow();
+            childarenas[i] = &childarena;
+            const size_t childfirst = bounds[i];
+            const size_t childlast = bounds[i+1];
+            pool->submit([this, &childarena, childfirst, childlast, level, checkcol]()
+            {
+                makeatree(childarena, childfirst, childlast, level + 1, checkcol);
+            }, pending);
+        }
+        pool->wait(pending);
+        for(size_t i{0}; i < 8; i++)
+        {
+            if(childarenas[i] == NULL)
+            {
+                nodes[pointer].Nodelist[i] = nullnode;
+                continue;
+            }
+            int child = nodes.splice(*childarenas[i]);
+            nodes[pointer].Nodelist[i] = child;
+            arena.giveback(*childarenas[i]);
+        }
+        return(pointer);
+    }
+
+    for(size_t i{0}; i < 8; i++)
+    {
+        if(bounds[i+1] > bounds[i])
+        {
+            int child = makeatree(nodes, bounds[i], bounds[i+1], level + 1, checkcol);
+            nodes[pointer].Nodelist[i] = child;
+        }
+        else
+        {
+            nodes[pointer].Nodelist[i] = nullnode;
+        }
+    }
+    return(pointer);
+}
+
+/**
+ * @brief Checks if a body is inside the boundaries of regi
+ * 
+ * @param b Input body
+ * @return true 
+ * @return false 
+ */
+template <typename T>
+bool Spacetree<T>::inregion(const body<T> &b)
+{
+    const array<array<T, 2>, 3> ranges = {regi.xrange, regi.yrange, regi.zrange};
+    for(size_t k{0}; k < 3; k++)
+    {
+        if(b.position[k] < ranges[k][0] || b.position[k] > ranges[k][1])
+        {
+            return(false);
+        }
+    }
+    return(true);
+}
+
+/**
+ * @brief Takes the bodies that have left the cell of their node out of the tree, moving them to the back of the range of their leaf. Nodes left with no bodies are dropped, and internal nodes left with a single leaf are replaced by that leaf
+ * 
+ * @param node Input node
+ * @param prefix Morton key bits of the cell of node (three per level, down to level mortonlevels)
+ * @param level Depth of node
+ * @param migrants Bodies taken out are added here
+ * @return int The node to put in place of node, or nullnode
+ */
+template <typename T>
+int Spacetree<T>::removemigrants(int node, unsigned long long prefix, size_t level, vector<body<T>> &migrants)
+{
+    if(arena[node].isleaf)
+    {
+        const size_t levels = min(level, mortonlevels);
+        const size_t first = arena[node].bodyrange[0];
+        const size_t leaving = migrants.size();
+        size_t kept = first;
+        for(size_t k{first}; k < arena[node].bodyrange[1]; k++)
+        {
+            const body<T> &b = arena.bodies[k];
+            if(!inregion(b) || (mortonkey(b) >> (3*(mortonlevels - levels))) != prefix)
+            {
+                migrants.push_back(b);
+                continue;
+            }
+            arena.bodies[kept] = b;
+            kept = kept + 1;
+        }
+        //The migrants are put back behind the bodies that stay, so that the bodies of arena are all still there if the refit is given up
+        for(size_t m{leaving}; m < migrants.size(); m++)
+        {
+            arena.bodies[kept + m - leaving] = migrants[m];
+        }
+        arena[node].bodyrange[1] = kept;
+        return((kept == first) ? nullnode : node);
+    }
+    size_t remaining{0};
+    int lastchild{nullnode};
+    for(size_t i{0}; i < 8; i++)
+    {
+        int child = arena[node].Nodelist[i];
+        if(child == nullnode)
+        {
+            continue;
+        }
+        const unsigned long long childprefix = (level < mortonlevels) ? ((prefix << 3) | i) : prefix;
+        child = removemigrants(child, childprefix, level + 1, migrants);
+        arena[node].Nodelist[i] = child;
+        if(child != nullnode)
+        {
+            remaining = remaining + 1;
+            lastchild = child;
+        }
+    }
+    if(remaining == 0)
+    {
+        return(nullnode);
+    }
+    if(remaining == 1 && arena[lastchild].isleaf)
+    {
+        return(lastchild);
+    }
+    return(node);
+}
+
+/**
+ * @brief Counts the bodies of a leaf during refit: those in its range plus those chained to it in extras
+ * 
+ * @param leaf Input leaf
+ * @return size_t 
+ */
+template <typename T>
+size_t Spacetree<T>::bucketsize(int leaf)
+{
+    size_t bodies = arena[leaf].bodyrange[1] - arena[leaf].bodyrange[0];
+    for(int e{firstextra[leaf]}; e != -1; e = nextextra[e])
+    {
+        bodies = bodies + 1;
+    }
+    return(bodies);
+}
+
+/**
+ * @brief Chains a body to a leaf in extras, on top of the bodies in the range of the leaf
+ * 
+ * @param leaf Input leaf
+ * @param b Body to add
+ */
+template <typename T>
+void Spacetree<T>::addtoleaf(int leaf, const body<T> &b)
+{
+    if(firstextra.size() < arena.size())
+    {
+        firstextra.resize(arena.size(), -1);
+    }
+    extras.push_back(b);
+    nextextra.push_back(firstextra[leaf]);
+    firstextra[leaf] = (int) extras.size() - 1;
+}
+
+/**
+ * @brief Puts a body back into the tree under the internal node "node", following the octants of its Morton key, and splits a full leaf it reaches. Below level mortonlevels the first free octant is taken, and leaves take any number of bodies
+ * 
+ * @param node Internal node to insert under
+ * @param b Body to insert
+ * @param level Depth of node
+ */
+template <typename T>
+void Spacetree<T>::insertbody(int node, const body<T> &b, size_t level)
+{
+    size_t octant{0};
+    if(level < mortonlevels)
+    {
+        octant = (mortonkey(b) >> (3*(mortonlevels - 1 - level))) & 7;
+    }
+    else
+    {
+        while(octant < 8 && arena[node].Nodelist[octant] != nullnode)
+        {
+            octant = octant + 1;
+        }
+        if(octant == 8)
+        {
+            octant = 0;
+        }
+    }
+    const int child = arena[node].Nodelist[octant];
+    if(child == nullnode)
+    {
+        const int leaf = addnulls(arena, arena.allocate());
+        arena[leaf].isleaf = true;
+        arena[leaf].bodyrange = {0, 0};
+        arena[node].Nodelist[octant] = leaf;
+        addtoleaf(leaf, b);
+        return;
+    }
+    if(!arena[child].isleaf)
+    {
+        insertbody(child, b, level + 1);
+        return;
+    }
+    if(bucketsize(child) < leafsize || level + 1 >= mortonlevels)
+    {
+        addtoleaf(child, b);
+        return;
+    }
+    vector<body<T>> bucket(arena.bodies.begin() + arena[child].bodyrange[0], arena.bodies.begin() + arena[child].bodyrange[1]);
+    for(int e{firstextra[child]}; e != -1; e = nextextra[e])
+    {
+        bucket.push_back(extras[e]);
+    }
+    const int split = addnulls(arena, arena.allocate());
+    arena[split].isleaf = false;
+    arena[node].Nodelist[octant] = split;
+    for(size_t k{0}; k < bucket.size(); k++)
+    {
+        insertbody(split, bucket[k], level + 1);
+    }
+    insertbody(split, b, level + 1);
+}
+
+/**
+ * @brief Recomputes the moments and body range of a node from its children, bottom-up, and those of a leaf from its bodies. If relayout is set, the bodies of the leaves are appended to laidout in depth first order, so the ranges come out contiguous as in a new tree.
+ * The extent cannot be put together from the children exactly, so an upper bound is used: each body is on average at most its child's mean distance plus the distance between the two centers of gravity away
+ * 
+ * @param node Input node
+ * @param level Depth of node
+ * @param depth Set to the depth of the deepest leaf found
+ */
+template <typename T>
+void Spacetree<T>::refitnode(int node, size_t level, size_t &depth)
+{
+    if(arena[node].isleaf)
+    {
+        Node<T> &leaf = arena[node];
+        depth = max(depth, level);
+        if(!relayout)
+        {
+            maxrads[node] = setmoments(leaf, arena.bodies, leaf.bodyrange[0], leaf.bodyrange[1]);
+            return;
+        }
+        const size_t first = laidout.size();
+        for(size_t k{leaf.bodyrange[0]}; k < leaf.bodyrange[1]; k++)
+        {
+            laidout.push_back(arena.bodies[k]);
+        }
+        if((size_t) node < firstextra.size())
+        {
+            for(int e{firstextra[node]}; e != -1; e = nextextra[e])
+            {
+                laidout.push_back(extras[e]);
+            }
+        }
+        const size_t last = laidout.size();
+        leaf.bodyrange = {first, last};
+        maxrads[node] = setmoments(leaf, laidout, first, last);
+        return;
+    }
+    T totmass{0};
+    T maxrad{0};
+    size_t first{0};
+    size_t last{0};
+    bool firstchild{true};
+    for(size_t i{0}; i < 8; i++)
+    {
+        const int child = arena[node].Nodelist[i];
+        if(child != nullnode)
+        {
+            refitnode(child, level + 1, depth);
+            totmass = totmass + arena[child].cogmass;
+            maxrad = max(maxrad, maxrads[child]);
+            if(firstchild)
+            {
+                first = arena[child].bodyrange[0];
+                firstchild = false;
+            }
+            last = arena[child].bodyrange[1];
+        }
+    }
+    array<T, 3> tempcog = {0,0,0};
+    for(size_t i{0}; i < 8; i++)
+    {
+        const int child = arena[node].Nodelist[i];
+        if(child != nullnode)
+        {
+            tempcog = tempcog + ((arena[child].cogmass)/(totmass))*arena[child].cog;
+        }
+    }
+    T spread{0};
+    array<T, 6> quadrupole = {0,0,0,0,0,0};
+    for(size_t i{0}; i < 8; i++)
+    {
+        const int child = arena[node].Nodelist[i];
+        if(child != nullnode)
+        {
+            const Node<T> &c = arena[child];
+            const T count = (T) (c.bodyrange[1] - c.bodyrange[0]);
+            const array<T, 3> r = c.cog - tempcog;
+            spread = spread + count*(c.extent/2 + moodulus(r));
+            //Parallel axis theorem: the child's own quadrupole plus that of its mass sitting at its center of gravity
+            const T weight = (c.cogmass)/(totmass);
+            quadrupole = quadrupole + weight*c.quadrupole;
+            addquadrupole(quadrupole, weight, r);
+        }
+    }
+    Node<T> &parent = arena[node];
+    parent.bodyrange = {first, last};
+    parent.cogmass = totmass;
+    parent.cog = tempcog;
+    parent.extent = 2*spread/(last - first);
+    parent.quadrupole = quadrupole;
+    maxrads[node] = maxrad;
+}
+
+/**
+ * @brief Updates collisions in a refitted tree the way makeatree does. The moments are made before the collisions here, so with merges the moments under the node are made again
+ * 
+ * @param node Input node
+ * @param checkcol Whether collisions have already been computed for the bodies of node
+ */
+template <typename T>
+void Spacetree<T>::refitcollisions(int node, bool checkcol)
+{
+    const size_t first = arena[node].bodyrange[0];
+    const size_t last = arena[node].bodyrange[1];
+    const T extent = arena[node].extent;
+    if(last - first > 1 && extent < 10*maxrads[node] && !checkcol)
+    {
+        updatecollision(arena.buffers.grid, first, last);
+        if(merge)
+        {
+            setsubtreemoments(node);
+        }
+        return;
+    }
+    if(arena[node].isleaf)
+    {
+        return;
+    }
+    for(size_t i{0}; i < 8; i++)
+    {
+        if(arena[node].Nodelist[i] != nullnode)
+        {
+            refitcollisions(arena[node].Nodelist[i], checkcol);
+        }
+    }
+}
+
+/**
+ * @brief Brings the tree rooted at root up to date with the moved bodies, instead of building a new one. regi has to be the region the tree was built from. Bodies that have left their cell are inserted again where they belong, the nodes are refitted bottom-up, the bodies are laid out again if any moved to another leaf, and collisions are updated.
+ * If the tree would get too bad this way, nothing useful is returned and a new tree has to be built
+ * 
+ * @param root Root of the tree in arena
+ * @param maxmigrants Most bodies that can leave their cell before a new tree is needed
+ * @param maxdepth Deepest the refitted tree can get before a new tree is needed
+ * @return int The new root, or nullnode if a body left regi, there were more than maxmigrants migrating bodies or the tree got deeper than maxdepth
+ */
+template <typename T>
+int Spacetree<T>::refit(int root, size_t maxmigrants, size_t maxdepth)
+{
+    if(root == nullnode || arena[root].isleaf)
+    {
+        return(nullnode);
+    }
+    vector<body<T>> &migrants = arena.buffers.migrants;
+    migrants.clear();
+    root = removemigrants(root, 0, 0, migrants);
+    if(migrants.size() > maxmigrants || root == nullnode || arena[root].isleaf)
+    {
+        return(nullnode);
+    }
+    extras.clear();
+    nextextra.clear();
+    firstextra.assign(arena.size(), -1);
+    for(size_t i{0}; i < migrants.size(); i++)
+    {
+        if(!inregion(migrants[i]))
+        {
+            return(nullnode);
+        }
+        insertbody(root, migrants[i], 0);
+    }
+    //Without migrants the leaves still cover the bodies of arena in order, so they are refitted where they are
+    relayout = !migrants.empty();
+    if(relayout)
+    {
+        laidout.clear();
+        laidout.reserve(arena.bodies.size());
+    }
+    maxrads.assign(arena.size(), 0);
+    size_t depth{0};
+    refitnode(root, 0, depth);
+    if(relayout)
+    {
+        arena.bodies.swap(laidout);
+    }
+    if(depth > maxdepth)
+    {
+        return(nullnode);
+    }
+    refitcollisions(root, false);
+    return(layout(root));
+}
+
+/**
+ * @brief Refits the moments of every node of the tree rooted at root to the moved bodies, without moving any body to another leaf. The cells get looser as the bodies move, so this is only meant for the steps between two refits or rebuilds
+ * 
+ * @param root Root of the tree in arena
+ * @param collide Whether collisions are updated as well, as in refit
+ */
+template <typename T>
+void Spacetree<T>::refresh(int root, bool collide)
+{
+    relayout = false;
+    maxrads.assign(arena.size(), 0);
+    size_t depth{0};
+    refitnode(root, 0, depth);
+    if(collide)
+    {
+        refitcollisions(root, false);
+    }
+}
+
+/**
+ * @brief Takes the bodies absorbed by merging collisions out of a vector of bodies, keeping the others in order, and numbers them from 0 again in the order of their old indices
+ * 
+ * @param bodies Input vector of bodies
+ * @return vector<body<T>> The absorbed bodies, with their old indices
+ */
+template <typename T>
+vector<body<T>> Spacetree<T>::mergebodies(vector<body<T>> &bodies)
+{
+    vector<body<T>> absorbed;
+    size_t kept{0};
+    for(size_t k{0}; k < bodies.size(); k++)
+    {
+        if(bodies[k].index < 0)
+        {
+            absorbed.push_back(bodies[k]);
+            absorbed.back().index = -1 - bodies[k].index;
+        }
+        else
+        {
+            bodies[kept] = bodies[k];
+            kept = kept + 1;
+        }
+    }
+    if(absorbed.empty())
+    {
+        return(absorbed);
+    }
+    bodies.resize(kept);
+    vector<int> gone(absorbed.size());
+    for(size_t a{0}; a < absorbed.size(); a++)
+    {
+        gone[a] = absorbed[a].index;
+    }
+    sort(gone.begin(), gone.end());
+    for(size_t k{0}; k < bodies.size(); k++)
+    {
+        bodies[k].index = bodies[k].index - (int) (lower_bound(gone.begin(), gone.end(), bodies[k].index) - gone.begin());
+    }
+    return(absorbed);
+}
+
+/**
+ * @brief Makes the moments of node and every node under it again from their bodies, as makeatree does
+ * 
+ * @param node Input node
+ */
+template <typename T>
+void Spacetree<T>::setsubtreemoments(int node)
+{
+    for(size_t i{0}; i < 8 && !arena[node].isleaf; i++)
+    {
+        if(arena[node].Nodelist[i] != nullnode)
+        {
+            setsubtreemoments(arena[node].Nodelist[i]);
+        }
+    }
+    setmoments(arena[node], arena.bodies, arena[node].bodyrange[0], arena[node].bodyrange[1]);
+}
+
+/**
+ * @brief Shifts the body range of node and the nodes under it past the absorbed bodies taken out. Empty nodes are dropped, and nodes that lost bodies get their moments made again
+ * 
+ * @param node Input node
+ * @param removed Number of absorbed bodies before each position of the bodies of arena, up to and including their number
+ * @return int node, or nullnode if it has no bodies left
+ */
+template <typename T>
+int Spacetree<T>::compactnode(int node, const vector<size_t> &removed)
+{
+    const size_t first = arena[node].bodyrange[0];
+    const size_t last = arena[node].bodyrange[1];
+    if(removed[last] - removed[first] == last - first)
+    {
+        return(nullnode);
+    }
+    for(size_t i{0}; i < 8 && !arena[node].isleaf; i++)
+    {
+        if(arena[node].Nodelist[i] != nullnode)
+        {
+            arena[node].Nodelist[i] = compactnode(arena[node].Nodelist[i], removed);
+        }
+    }
+    arena[node].bodyrange = {first - removed[first], last - removed[last]};
+    if(removed[last] != removed[first])
+    {
+        setmoments(arena[node], arena.bodies, arena[node].bodyrange[0], arena[node].bodyrange[1]);
+    }
+    return(node);
+}
+
+/**
+ * @brief Takes the bodies absorbed by merging collisions out of the bodies of arena and fits the tree rooted at root to the bodies left, in place
+ * 
+ * @param root Root of the tree in arena
+ * @param absorbed Filled with the absorbed bodies, with their old indices
+ * @return int The new root
+ */
+template <typename T>
+int Spacetree<T>::compact(int root, vector<body<T>> &absorbed)
+{
+    vector<size_t> removed(arena.bodies.size() + 1, 0);
+    for(size_t k{0}; k < arena.bodies.size(); k++)
+    {
+        removed[k+1] = removed[k] + ((arena.bodies[k].index < 0) ? 1 : 0);
+    }
+    if(removed.back() == 0)
+    {
+        absorbed.clear();
+        return(root);
+    }
+    absorbed = mergebodies(arena.bodies);
+    root = compactnode(root, removed);
+    return(layout(root));
+}
+
+/**
+ * @brief Unmaps the file when the mappedfile goes out of scope
+ * 
+ */
+mappedfile::~mappedfile()
+{
+    close();
+}
+
+/**
+ * @brief Maps a whole file read-only into memory. Empty files are not mapped
+ * 
+ * @param filename File to map
+ * @return true if the file was mapped
+ */
+bool mappedfile::open(const string &filename)
+{
+    close();
+#ifdef _WIN32
+    filehandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(filehandle == INVALID_HANDLE_VALUE)
+    {
+        filehandle = NULL;
+        return(false);
+    }
+    LARGE_INTEGER filesize;
+    if(!GetFileSizeEx(filehandle, &filesize) || filesize.QuadPart == 0)
+    {
+        close();
+        return(false);
+    }
+    maphandle = CreateFileMappingA(filehandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(maphandle == NULL)
+    {
+        close();
+        return(false);
+    }
+    bytes = (const unsigned char*) MapViewOfFile(maphandle, FILE_MAP_READ, 0, 0, 0);
+    if(bytes == NULL)
+    {
+        close();
+        return(false);
+    }
+    length = (size_t) filesize.QuadPart;
+#else
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return(false);
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        return(false);
+    }
+    void* mapped = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(mapped == MAP_FAILED)
+    {
+        return(false);
+    }
+    bytes = (const unsigned char*) mapped;
+    length = (size_t) info.st_size;
+#endif
+    return(true);
+}
+
+/**
+ * @brief Unmaps the file, if one is mapped
+ * 
+ */
+void mappedfile::close()
+{
+#ifdef _WIN32
+    if(bytes != NULL)
+    {
+        UnmapViewOfFile(bytes);
+    }
+    if(maphandle != NULL)
+    {
+        CloseHandle(maphandle);
+    }
+    if(filehandle != NULL)
+    {
+        CloseHandle(filehandle);
+    }
+    maphandle = NULL;
+    filehandle = NULL;
+#else
+    if(bytes != NULL)
+    {
+        munmap((void*) bytes, length);
+    }
+#endif
+    bytes = NULL;
+    length = 0;
+}
+
+/**
+ * @brief Start of the mapped file
+ * 
+ * @return const unsigned char* 
+ */
+const unsigned char* mappedfile::data()
+{
+    return(bytes);
+}
+
+/**
+ * @brief Size of the mapped file in bytes
+ * 
+ * @return size_t 
+ */
+size_t mappedfile::size()
+{
+    return(length);
+}
+
+/**
+ * @brief Size in bytes of the header of a binary snapshot, and the version of the format written
+ * 
+ */
+const size_t snapshotheadersize{48};
+const uint32_t snapshotversion{1};
+
+/**
+ * @brief Stores an unsigned integer at out, least significant byte first, whatever the byte order of the machine
+ * 
+ * @tparam U Unsigned integer type
+ * @param out Where to store it
+ * @param v The integer
+ */
+template <typename U>
+void putlittleendian(unsigned char* out, U v)
+{
+    for(size_t b{0}; b < sizeof(U); b++)
+    {
+        out[b] = (unsigned char) (v >> (8*b));
+    }
+}
+
+/**
+ * @brief Reads an unsigned integer stored least significant byte first
+ * 
+ * @tparam U Unsigned integer type
+ * @param in Where it is stored
+ * @return U 
+ */
+template <typename U>
+U getlittleendian(const unsigned char* in)
+{
+    U v{0};
+    for(size_t b{0}; b < sizeof(U); b++)
+    {
+        v = v | ((U) in[b] << (8*b));
+    }
+    return(v);
+}
+
+/**
+ * @brief Stores a scalar as a little-endian IEEE float (precision 4), double (precision 8), or pair of doubles (precision 16) whose sum is the scalar, which keeps all the digits of an 80 bit long double
+ * 
+ * @tparam T Scalar type
+ * @param out Where to store it
+ * @param v The scalar
+ * @param precision 4, 8 or 16
+ */
+template <typename T>
+void putscalar(unsigned char* out, T v, size_t precision)
+{
+    if(precision == 4)
+    {
+        const float f = (float) v;
+        uint32_t u;
+        memcpy(&u, &f, 4);
+        putlittleendian(out, u);
+    }
+    else
+    {
+        const double d = (double) v;
+        uint64_t u;
+        memcpy(&u, &d, 8);
+        putlittleendian(out, u);
+        if(precision == 16)
+        {
+            const double low = isfinite(d) ? (double) (v - (T) d) : 0;
+            memcpy(&u, &low, 8);
+            putlittleendian(out + 8, u);
+        }
+    }
+}
+
+/**
+ * @brief Reads a scalar stored by putscalar
+ * 
+ * @tparam T Scalar type to return
+ * @param in Where it is stored
+ * @param precision 4, 8 or 16
+ * @return T 
+ */
+template <typename T>
+T getscalar(const unsigned char* in, size_t precision)
+{
+    if(precision == 4)
+    {
+        const uint32_t u = getlittleendian<uint32_t>(in);
+        float f;
+        memcpy(&f, &u, 4);
+        return((T) f);
+    }
+    const uint64_t u = getlittleendian<uint64_t>(in);
+    double d;
+    memcpy(&d, &u, 8);
+    if(precision == 16)
+    {
+        return((T) d + getscalar<T>(in + 8, 8));
+    }
+    return((T) d);
+}
+
+/**
+ * @brief The scalar fields of a body in the order of the columns of a binary snapshot: x, y, z, vx, vy, vz, mass, radius
+ * 
+ * @tparam B body<T> or const body<T>
+ * @param b The body
+ * @param c Column, 0 to 7
+ * @return auto& 
+ */
+template <typename B>
+auto& bodyfield(B &b, size_t c)
+{
+    if(c < 3)
+    {
+        return(b.position[c]);
+    }
+    if(c < 6)
+    {
+        return(b.velocity[c - 3]);
+    }
+    if(c == 6)
+    {
+        return(b.mass);
+    }
+    return(b.radius);
+}
+
+/**
+ * @brief Checks if a file name is that of a binary snapshot: it ends in .nbs, or in .nbs.N like the snapshots written by simulate
+ * 
+ * @param filename File name
+ * @return true if the file is binary
+ */
+template <typename T>
+bool snapshot<T>::isbinary(const string &filename)
+{
+    const size_t dot = filename.rfind(".nbs");
+    return(dot != string::npos && (dot + 4 == filename.size() || filename[dot + 4] == '.'));
+}
+
+/**
+ * @brief Reads the bodies of a snapshot, binary or CSV depending on the file name. The accelerations are set to zero
+ * 
+ * @param filename File to read
+ * @param bodies Filled with the bodies
+ * @return true if the file could be read and its indices are 0 to n-1, each once
+ */
+template <typename T>
+bool snapshot<T>::read(const string &filename, vector<body<T>> &bodies)
+{
+    const bool done = isbinary(filename) ? readbinary(filename, bodies) : readcsv(filename, bodies);
+    return(done && ispermutation(bodies));
+}
+
+/**
+ * @brief Checks that the indices of the bodies are 0 to n-1, each once, as the run looks bodies up by their index
+ * 
+ * @param bodies The bodies read
+ * @return true if the indices are a permutation of 0 to n-1
+ */
+template <typename T>
+bool snapshot<T>::ispermutation(const vector<body<T>> &bodies)
+{
+    vector<bool> seen(bodies.size(), false);
+    for(const body<T> &b : bodies)
+    {
+        if(b.index < 0 || (size_t) b.index >= bodies.size() || seen[b.index])
+        {
+            return(false);
+        }
+        seen[b.index] = true;
+    }
+    return(true);
+}
+
+/**
+ * @brief Writes the bodies to a snapshot, binary or CSV depending on the file name
+ * 
+ * @param filename File to write
+ * @param bodies The bodies
+ * @return true if the file could be written
+ */
+template <typename T>
+bool snapshot<T>::write(const string &filename, const vector<body<T>> &bodies)
+{
+    if(isbinary(filename))
+    {
+        return(writebinary(filename, bodies));
+    }
+    return(writecsv(filename, bodies));
+}
+
+/**
+ * @brief Reads a binary snapshot. The file is mapped into memory and every column is copied straight into the bodies, so nothing is parsed
+ * 
+ * @param filename File to read
+ * @param bodies Filled with the bodies
+ * @return true if the file is a complete binary snapshot
+ */
+template <typename T>
+bool snapshot<T>::readbinary(const string &filename, vector<body<T>> &bodies)
+{
+    mappedfile file;
+    if(!file.open(filename) || file.size() < snapshotheadersize)
+    {
+        return(false);
+    }
+    const unsigned char* header = file.data();
+    if(memcmp(header, "NBODYSNP", 8) != 0 || getlittleendian<uint32_t>(header + 8) != snapshotversion)
+    {
+        return(false);
+    }
+    const size_t precision = getlittleendian<uint32_t>(header + 12);
+    const uint64_t n = getlittleendian<uint64_t>(header + 16);
+    if((precision != 4 && precision != 8 && precision != 16) || n > (file.size() - snapshotheadersize)/(8 + 8*precision))
+    {
+        return(false);
+    }
+    step = (size_t) getlittleendian<uint64_t>(header + 24);
+    time = getscalar<double>(header + 32, 8);
+    bodies.resize((size_t) n);
+    const unsigned char* column = header + snapshotheadersize;
+    for(size_t i{0}; i < n; i++)
+    {
+        bodies[i].index = (int) (int64_t) getlittleendian<uint64_t>(column + 8*i);
+        bodies[i].acceleration = {0,0,0};
+        bodies[i].newacceleration = {0,0,0};
+    }
+    column = column + 8*n;
+    for(size_t c{0}; c < 8; c++)
+    {
+        for(size_t i{0}; i < n; i++)
+        {
+            bodyfield(bodies[i], c) = getscalar<T>(column + precision*i, precision);
+        }
+        column = column + precision*n;
+    }
+    return(true);
+}
+
+/**
+ * @brief Reads a CSV file in the format of the initial condition files: index, position, velocity, mass and radius on each line
+ * 
+ * @param filename File to read
+ * @param bodies Filled with the bodies
+ * @return true if the file could be opened
+ */
+template <typename T>
+bool snapshot<T>::readcsv(const string &filename, vector<body<T>> &bodies)
+{
+    string infolist[8];
+    string radiuss;
+    ifstream file(filename);
+    if(!file.is_open())
+    {
+        return(false);
+    }
+    bodies.resize(0);
+    int previndex{-1};
+    while(file.is_open() == true)
+    {
+        body<T> newbody;
+        for(size_t i{0}; i < 8; i++)
+        {
+            getline(file, infolist[i], ',');
+        }
+        getline(file, radiuss, '\n');
+        if(stoi(infolist[0]) == previndex)
+        {
+            break;
+        }
+        newbody.index = stoi(infolist[0]);
+        newbody.position = {(T) stold(infolist[1]),(T) stold(infolist[2]),(T) stold(infolist[3])};
+        newbody.velocity = {(T) stold(infolist[4]),(T) stold(infolist[5]),(T) stold(infolist[6])};
+        newbody.mass = (T) stold(infolist[7]);
+        newbody.radius = (T) stold(radiuss);
+        newbody.acceleration = {0,0,0};
+        newbody.newacceleration = {0,0,0};
+        bodies.push_back(newbody);
+        previndex = newbody.index;
+    }
+    file.close();
+    return(true);
+}
+
+/**
+ * @brief Writes a binary snapshot. The whole file is put together in memory, column by column, and written at once
+ * 
+ * @param filename File to write
+ * @param bodies The bodies
+ * @return true if the file could be written
+ */
+template <typename T>
+bool snapshot<T>::writebinary(const string &filename, const vector<body<T>> &bodies)
+{
+    size_t precision{8};
+    if(sizeof(T) == 4)
+    {
+        precision = 4;
+    }
+    else if(numeric_limits<T>::digits > numeric_limits<double>::digits)
+    {
+        precision = 16;
+    }
+    const size_t n = bodies.size();
+    vector<unsigned char> bytes(snapshotheadersize + n*(8 + 8*precision));
+    unsigned char* header = bytes.data();
+    memcpy(header, "NBODYSNP", 8);
+    putlittleendian(header + 8, snapshotversion);
+    putlittleendian(header + 12, (uint32_t) precision);
+    putlittleendian(header + 16, (uint64_t) n);
+    putlittleendian(header + 24, (uint64_t) step);
+    putscalar(header + 32, time, 8);
+    putlittleendian(header + 40, (uint64_t) 0);
+    unsigned char* column = header + snapshotheadersize;
+    for(size_t i{0}; i < n; i++)
+    {
+        putlittleendian(column + 8*i, (uint64_t) (int64_t) bodies[i].index);
+    }
+    column = column + 8*n;
+    for(size_t c{0}; c < 8; c++)
+    {
+        for(size_t i{0}; i < n; i++)
+        {
+            putscalar(column + precision*i, bodyfield(bodies[i], c), precision);
+        }
+        column = column + precision*n;
+    }
+    ofstream file(filename, ios::binary);
+    file.write((const char*) bytes.data(), (streamsize) bytes.size());
+    return(file.good());
+}
+
+/**
+ * @brief Writes a CSV file in the format of the initial condition files, so that it can be used as an input file
+ * 
+ * @param filename File to write
+ * @param bodies The bodies
+ * @return true if the file could be written
+ */
+template <typename T>
+bool snapshot<T>::writecsv(const string &filename, const vector<body<T>> &bodies)
+{
+    ofstream file;
+    file.precision(30);
+    file.open(filename);
+    for(size_t i{0}; i < bodies.size(); i++)
+    {
+        file << fixed << bodies[i];
+        if(i + 1 < bodies.size())
+        {
+            file << '\n';
+        }
+    }
+    return(file.good());
+}
+
+/**
+ * @brief Construct a new snapshotwriter object and start its thread
+ * 
+ * @param queuedepth Number of snapshots that can be queued (at least 1)
+ */
+template <typename T>
+snapshotwriter<T>::snapshotwriter(size_t queuedepth)
+    : depth{max(queuedepth, (size_t) 1)}
+{
+    worker = thread(&snapshotwriter<T>::workerloop, this);
+}
+
+/**
+ * @brief Writes whatever is still queued and stops the thread
+ * 
+ */
+template <typename T>
+snapshotwriter<T>::~snapshotwriter()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    queued.notify_all();
+    worker.join();
+}
+
+/**
+ * @brief Queues a copy of the bodies to be written, waiting only if depth snapshots are already queued. Files whose name snapshot::isbinary accepts are written in the binary format, the rest as CSV of the positions and radii
+ * 
+ * @param filename File to write
+ * @param bodies The bodies, in any order. Each is copied to the place of its index, so the snapshot lists them in the order of their indices, which run from 0 to the number of bodies - 1
+ * @param step Number of timesteps done
+ * @param time Simulated time
+ */
+template <typename T>
+void snapshotwriter<T>::submit(const string &filename, const vector<body<T>> &bodies, size_t step, double time)
+{
+    unique_lock<mutex> guard(lock);
+    written.wait(guard, [this]{return(queue.size() < depth);});
+    pending next;
+    if(!freebuffers.empty())
+    {
+        next.bodies = move(freebuffers.back());
+        freebuffers.pop_back();
+    }
+    guard.unlock();
+    next.filename = filename;
+    next.step = step;
+    next.time = time;
+    next.bodies.resize(bodies.size());
+    for(size_t k{0}; k < bodies.size(); k++)
+    {
+        next.bodies[bodies[k].index] = bodies[k];
+    }
+    guard.lock();
+    queue.push_back(move(next));
+    guard.unlock();
+    queued.notify_one();
+}
+
+/**
+ * @brief Queues a text file to be written as it is, after the snapshots queued before it. Waits only if depth files are already queued
+ * 
+ * @param filename File to write
+ * @param text Contents of the file
+ */
+template <typename T>
+void snapshotwriter<T>::submittext(const string &filename, string text)
+{
+    unique_lock<mutex> guard(lock);
+    written.wait(guard, [this]{return(queue.size() < depth);});
+    pending next;
+    next.filename = filename;
+    next.step = 0;
+    next.time = 0;
+    next.text = move(text);
+    queue.push_back(move(next));
+    guard.unlock();
+    queued.notify_one();
+}
+
+/**
+ * @brief Waits until every queued snapshot has been written
+ * 
+ */
+template <typename T>
+void snapshotwriter<T>::finish()
+{
+    unique_lock<mutex> guard(lock);
+    written.wait(guard, [this]{return(queue.empty() && !writing);});
+}
+
+/**
+ * @brief Loop of the writer thread. Takes the oldest queued snapshot, writes it without holding the lock, then gives its buffer back. Text files queued by submittext have no buffer to give back
+ * 
+ */
+template <typename T>
+void snapshotwriter<T>::workerloop()
+{
+    unique_lock<mutex> guard(lock);
+    while(true)
+    {
+        queued.wait(guard, [this]{return(!queue.empty() || stopping);});
+        if(queue.empty())
+        {
+            return;
+        }
+        pending next = move(queue.front());
+        queue.pop_front();
+        writing = true;
+        guard.unlock();
+        const bool textfile = !next.text.empty();
+        if(textfile)
+        {
+            ofstream datafile(next.filename);
+            datafile << next.text;
+        }
+        else if(snapshot<T>::isbinary(next.filename))
+        {
+            snapshot<T> state;
+            state.step = next.step;
+            state.time = next.time;
+            state.write(next.filename, next.bodies);
+        }
+        else
+        {
+            ofstream datafile;
+            datafile.precision(30);
+            datafile.open(next.filename);
+            datafile << fixed << next.bodies;
+            datafile.close();
+        }
+        guard.lock();
+        writing = false;
+        if(!textfile)
+        {
+            freebuffers.push_back(move(next.bodies));
+        }
+        written.notify_all();
+    }
+}
+
+/**
+ * @brief Wall time since a point in time
+ * 
+ * @param start The point in time
+ * @return double The time in seconds
+ */
+double secondssince(chrono::steady_clock::time_point start)
+{
+    chrono::duration<double> elapsed{chrono::steady_clock::now() - start};
+    return(elapsed.count());
+}
+
+/**
+ * @brief Construct a new bodygen::bodygen object. This constructor is called if there is an input file.
+ * 
+ * @param inputstring Initializes filename to inputstring. This is the desired filename to read
+ * @param tstepinput Initializes timestep to tstepinput. This is the desired timestep
+ * @param iter Initializes iter to iterations. This is the total number of iterations
+ */
+template <typename T, typename K>
+bodygen<T, K>::bodygen(const string inputstring, T tstepinput, const size_t iter)
+    : filename{inputstring}, timestep{tstepinput}, iterations{iter} 
+{
+    writeinitfile = false;
+}
+
+/**
+ * @brief Construct a new bodygen::bodygen object. This constructor is called if there is no input file.
+ * 
+ * @param inputcount Initializes count to inputcount. This is the desired number of bodies
+ * @param st Initializes filename to st. This is the desired filename to write the generate initial data to
+ * @param tstepinput Initializes timestep to tstepinput. This is the desired timestep
+ * @param iter Initializes iter to iterations. This is the total number of iterations
+ */
+template <typename T, typename K>
+bodygen<T, K>::bodygen(const size_t inputcount, const string st, T tstepinput, const size_t iter)
+    : count{inputcount}, filename{st}, timestep{tstepinput}, iterations{iter} 
+{                                                                           
+    writeinitfile = true;
+}
+
+/**
+ * @brief Sets the optional settings of the run. A pool of threads is made if more than one thread is asked for. The force kernel has to be one chooseforcekernel accepts
+ * 
+ * @param inputoptions The settings
+ */
+template <typename T, typename K>
+bool bodygen<T, K>::setoptions(const simoptions &inputoptions)
+{
+    options = inputoptions;
+    kernel = chooseforcekernel<T,K>(options.kernel);
+    if(options.integrator != "verlet")
+    {
+        scheme = integrator(options.integrator);
+    }
+    pool.reset();
+    if(options.threads > 1)
+    {
+        pool = make_unique<threadpool>(options.threads);
+    }
+    counters = options.stats ? &stats : NULL;
+    return(kernel != NULL);
+}
+
+/**
+ * @brief The main function that does the Nbody simulation. Either a file is read, or data is generated. Updating functions are run to update the bodies before the tree is remade (or refitted, or done by blockstep with options.blocksteps). Snapshots are written by writer while the next timesteps are computed.
+ * With options.stats, the counters of the timesteps since the last snapshot are written next to it (see writestats)
+ * With options.errorreport, the accelerations of the steps a snapshot is written on are checked against a direct sum by reporterror, and the rows are written to filename.forceerror.csv at the end
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::simulate()
+{
+    if(writeinitfile)
+    {
+        datatree = makebodies(); //Make bodies if theres no initial data file
+    }
+    else
+    {
+        array<T, 6> minmax = {0,0,0,0,0,0};
+        snapshot<T> initial;
+        if(!initial.read(filename, treenodes.bodies)) //Reads initial data file straight into the store of the tree
+        {
+            cout << "Could not read " << filename << "\n";
+            return;
+        }
+        for(size_t i{0}; i < treenodes.bodies.size(); i++)
+        {
+            const body<T> &newbody = treenodes.bodies[i];
+            size_t k2{0};
+            for(size_t k{0}; k < 3; k++)
+            {
+                if(newbody.position[k] < minmax[k2])
+                {
+                    minmax[k2] = newbody.position[k];
+                }
+                else if(newbody.position[k] > minmax[k2+1])
+                {
+                    minmax[k2+1] = newbody.position[k];
+                }
+                k2 = k2 + 2;
+            }
+        }
+        space.xrange = {minmax[0] - 1,minmax[1] + 1};
+        space.yrange = {minmax[2] - 1,minmax[3] + 1};
+        space.zrange = {minmax[4] - 1,minmax[5] + 1};
+        Spacetree<T> space_tree{space, treenodes, pool.get(), options.buildcutoff, options.leafsize, counters, options.collisions};
+        datatree = space_tree.treegen();
+    }
+    string strdirname = filename.substr(0, filename.size()-4);
+    const char* dirname = strdirname.c_str();
+    mkdir(dirname);
+    writer = make_unique<snapshotwriter<T>>(options.writequeue);
+    builtdepth = treedepth(datatree);
+    if(options.collisions == "merge")
+    {
+        compactbodies();
+    }
+    if(options.blocksteps > 0)
+    {
+        startblocksteps();
+    }
+    size_t j{0};
+    int ccount{0};
+    statsrows.clear();
+    for(size_t i{0}; i < iterations; i++)
+    {
+        chrono::time_point stepstart{chrono::steady_clock::now()};
+        stats.clear();
+        if(counters != NULL)
+        {
+            storesbefore.clear();
+            storecapacities(storesbefore);
+        }
+        bool snapshotted{false};
+        if(options.blocksteps > 0)
+        {
+            blockstep();
+        }
+        else if(options.integrator != "verlet")
+        {
+            symplecticstep();
+        }
+        else
+        {
+            computeaccelerations();
+            if(options.errorreport && j == 100)
+            {
+                reporterror(i + 1);
+            }
+            update();
+        }
+        if(j == 100)
+        {
+            chrono::time_point writestart{chrono::steady_clock::now()};
+            const string extension = (options.snapshots == "binary") ? ".nbs." : ".csv.";
+            filename = ".\\" + strdirname + "\\" + strdirname + extension + to_string(ccount);
+            writer->submit(filename, treenodes.bodies, i + 1, (double) (i + 1)*(double) timestep);
+            stats.write = secondssince(writestart);
+            snapshotted = true;
+        }
+        if(options.blocksteps == 0 && options.integrator == "verlet")
+        {
+            maintaintree();
+        }
+        if(counters != NULL)
+        {
+            stats.allocated.fetch_add(grownbytes(), memory_order_relaxed);
+            recordstats(i + 1, secondssince(stepstart));
+        }
+        if(snapshotted)
+        {
+            if(counters != NULL)
+            {
+                writestats(".\\" + strdirname + "\\" + strdirname + ".stats.csv." + to_string(ccount));
+            }
+            j = 0;
+            ccount = ccount + 1;
+        }
+        j = j + 1;
+    }
+    if(counters != NULL && !statsrows.empty())
+    {
+        writestats(".\\" + strdirname + "\\" + strdirname + ".stats.csv." + to_string(ccount));
+    }
+    if(!errorrows.empty())
+    {
+        writer->submittext(".\\" + strdirname + "\\" + strdirname + ".forceerror.csv", "step,bodies,enginetime,directtime,rms,median,p99,max\n" + errorrows);
+        errorrows.clear();
+    }
+    writer->finish();
+}
+
+/**
+ * @brief Replaces the bodies of the simulation with the given ones and builds a tree over them, so the phases of a timestep can be run one at a time (see bench.cpp). With options.blocksteps, the block timesteps are started as in simulate
+ * 
+ * @param bodies The new bodies. Their indices have to run from 0 to the number of bodies - 1
+ */
+template <typename T, typename K>
+void bodygen<T, K>::setbodies(const vector<body<T>> &bodies)
+{
+    treenodes.bodies = bodies;
+    listleaves.clear();
+    blocklevels.clear();
+    treeage = 0;
+    array<T,6> minimaxi = calcminmax();
+    space.xrange = {minimaxi[0] - 1,minimaxi[1] + 1};
+    space.yrange = {minimaxi[2] - 1,minimaxi[3] + 1};
+    space.zrange = {minimaxi[4] - 1,minimaxi[5] + 1};
+    Spacetree<T> space_tree{space, treenodes, pool.get(), options.buildcutoff, options.leafsize, counters, options.collisions};
+    datatree = space_tree.treegen();
+    builtdepth = treedepth(datatree);
+    if(options.collisions == "merge")
+    {
+        compactbodies();
+    }
+    if(options.blocksteps > 0)
+    {
+        startblocksteps();
+    }
+}
+
+/**
+ * @brief Advances all bodies by one timestep with the integrator picked in options, the way simulate does but without the snapshots and error reports, so check.cpp can follow a run step by step. Call setbodies first
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::step()
+{
+    if(options.blocksteps > 0)
+    {
+        blockstep();
+    }
+    else if(options.integrator != "verlet")
+    {
+        symplecticstep();
+    }
+    else
+    {
+        computeaccelerations();
+        update();
+        maintaintree();
+    }
+}
+
+/**
+ * @brief Adds the acceleration of every body of the tree to its newacceleration, with the engine picked in options, after tuning options.theta if it is due (see tunetheta). The time taken is added to stats
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::computeaccelerations()
+{
+    chrono::time_point start{chrono::steady_clock::now()};
+    const bool direct = options.engine == "direct" && treenodes.bodies.size() <= options.directmax;
+    const bool quadrupoles = options.multipole == "quadrupole";
+    if(options.errortarget > 0 && options.engine != "fmm" && !direct)
+    {
+        if(tunepasses % options.tuneevery == 0)
+        {
+            tunetheta();
+        }
+        tunepasses = tunepasses + 1;
+    }
+    if(direct)
+    {
+        fillmoments();
+        directacceleration();
+    }
+    else if(options.engine == "fmm")
+    {
+        fmm.accelerations(treenodes, datatree, pool.get(), options.theta, quadrupoles);
+    }
+    else if(options.listreuse > 0 && options.engine == "tree")
+    {
+        fillmoments();
+        cachedacceleration(quadrupoles);
+    }
+    else if(options.walk == "group")
+    {
+        fillmoments();
+        groupacceleration(quadrupoles);
+    }
+    else if(pool)
+    {
+        fillmoments();
+        parallelacceleration(quadrupoles);
+    }
+    else
+    {
+        fillmoments();
+        updateallacceleration(datatree, datatree, quadrupoles);
+    }
+    stats.force = stats.force + secondssince(start);
+}
+
+/**
+ * @brief Brings the tree up to date with its bodies with updatetree, and takes out the bodies absorbed on the way with compactbodies. The time taken is added to stats
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::maintaintree()
+{
+    chrono::time_point start{chrono::steady_clock::now()};
+    const double boundsbefore = stats.bounds;
+    updatetree(options.collisions);
+    if(options.collisions == "merge")
+    {
+        compactbodies();
+    }
+    stats.build = stats.build + secondssince(start) - (stats.bounds - boundsbefore);
+}
+
+/**
+ * @brief Brings the tree up to date with its bodies after they have moved, by refitting it with options.tree set to "refit", otherwise by building a new one. With options.listreuse this is only done every options.listreuse times, and the moments and collisions are refreshed in between so the cached lists can be kept
+ * 
+ * @param collisions What the bodies that collide on the way do: options.collisions, or "none" to leave them alone
+ */
+template <typename T, typename K>
+void bodygen<T, K>::updatetree(const string &collisions)
+{
+    if(options.listreuse > 0 && options.engine == "tree" && options.blocksteps == 0)
+    {
+        treeage = treeage + 1;
+        if(treeage < options.listreuse)
+        {
+            Spacetree<T> refresh_tree{space, treenodes, pool.get(), options.buildcutoff, options.leafsize, counters, collisions};
+            refresh_tree.refresh(datatree, collisions != "none");
+            return;
+        }
+        treeage = 0;
+        listleaves.clear();
+    }
+    int refitted{nullnode};
+    if(options.tree == "refit")
+    {
+        Spacetree<T> refit_tree{space, treenodes, pool.get(), options.buildcutoff, options.leafsize, counters, collisions};
+        refitted = refit_tree.refit(datatree, (size_t) (options.refitmigrants*treenodes.bodies.size()), builtdepth + maxdepthgrowth);
+    }
+    if(refitted != nullnode)
+    {
+        datatree = refitted;
+        return;
+    }
+    rebuildtree(collisions);
+}
+
+/**
+ * @brief Builds a new tree over the bodies in place of the old one, in a region around their boundaries (with a margin for refitting with options.tree set to "refit")
+ * 
+ * @param collisions What the bodies that collide while the tree is built do: options.collisions, or "none" to leave them alone
+ */
+template <typename T, typename K>
+void bodygen<T, K>::rebuildtree(const string &collisions)
+{
+    chrono::time_point boundsstart{chrono::steady_clock::now()};
+    array<T,6> minimaxi = calcminmax();
+    stats.bounds = stats.bounds + secondssince(boundsstart);
+    space.xrange = {minimaxi[0] - 1,minimaxi[1] + 1};
+    space.yrange = {minimaxi[2] - 1,minimaxi[3] + 1};
+    space.zrange = {minimaxi[4] - 1,minimaxi[5] + 1};
+    if(options.tree == "refit")
+    {
+        for(array<T, 2>* range : {&space.xrange, &space.yrange, &space.zrange})
+        {
+            const T margin = (T) refitmargin*((*range)[1] - (*range)[0]);
+            *range = {(*range)[0] - margin, (*range)[1] + margin};
+        }
+    }
+    Spacetree<T> space_tree{space, treenodes, pool.get(), options.buildcutoff, options.leafsize, counters, collisions};
+    datatree = space_tree.treegen();
+    builtdepth = treedepth(datatree);
+}
+
+/**
+ * @brief Takes the bodies absorbed by merging collisions out of the tree in place (see Spacetree::compact), so the bodies keep running from 0 to their number - 1, and renumbers the block timestep levels with them. The cached interaction lists are thrown away
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::compactbodies()
+{
+    Spacetree<T> merge_tree{space, treenodes, pool.get(), options.buildcutoff, options.leafsize, counters, options.collisions};
+    vector<body<T>> absorbed;
+    datatree = merge_tree.compact(datatree, absorbed);
+    if(absorbed.empty())
+    {
+        return;
+    }
+    if(!blocklevels.empty())
+    {
+        vector<bool> gone(blocklevels.size(), false);
+        for(size_t a{0}; a < absorbed.size(); a++)
+        {
+            gone[absorbed[a].index] = true;
+        }
+        size_t kept{0};
+        for(size_t k{0}; k < blocklevels.size(); k++)
+        {
+            if(!gone[k])
+            {
+                blocklevels[kept] = blocklevels[k];
+                kept = kept + 1;
+            }
+        }
+        blocklevels.resize(kept);
+    }
+    listleaves.clear();
+}
+
+/**
+ * @brief Adds a row for the timestep just done to statsrows, from stats and the tree as it is now. The time that no other phase took is put down to moving the bodies (integrate)
+ * 
+ * @param step Number of timesteps done
+ * @param steptime Wall time of the whole timestep, in seconds
+ */
+template <typename T, typename K>
+void bodygen<T, K>::recordstats(size_t step, double steptime)
+{
+    const double collide = (double) stats.collide.load()*1E-9;
+    const double integrate = max(steptime - stats.bounds - stats.build - stats.force - stats.write, 0.0);
+    ostringstream row;
+    row << step << ',' << stats.bounds << ',' << stats.build << ',' << collide << ',' << stats.force << ',' << integrate << ',' << stats.write << ',';
+    row << treedepth(datatree) << ',' << treenodes.size() << ',' << stats.lists.load() << ',' << stats.visits.load() << ',' << stats.interactions.load() << ',';
+    row << stats.maxvisits.load() << ',' << stats.maxinteractions.load() << ',' << stats.collisionchecks.load() << ',' << stats.allocated.load() << ',' << heldbytes() << ',' << options.theta << '\n';
+    statsrows.append(row.str());
+}
+
+/**
+ * @brief Hands the rows of statsrows to writer as a CSV file with a header (see stepstats), and starts over
+ * 
+ * @param statsname File to write
+ */
+template <typename T, typename K>
+void bodygen<T, K>::writestats(const string &statsname)
+{
+    string text = "step,bounds,build,collide,force,integrate,write,depth,nodes,lists,visits,interactions,maxvisits,maxinteractions,collisionchecks,allocbytes,heldbytes,theta\n";
+    text.append(statsrows);
+    statsrows.clear();
+    writer->submittext(statsname, move(text));
+}
+
+/**
+ * @brief Appends the bytes held by each main store of the simulation to sizes: the stores of treenodes, nodemoments and the other vectors kept between timesteps. The cached lists are left out, as buildgrouplist counts their growth
+ * 
+ * @param sizes Output, one entry per store
+ */
+template <typename T, typename K>
+void bodygen<T, K>::storecapacities(vector<size_t> &sizes)
+{
+    treenodes.capacities(sizes);
+    sizes.push_back(10*nodemoments.x.capacity()*sizeof(T));
+    for(vector<int>* store : {&leaves, &groups, &listleaves})
+    {
+        sizes.push_back(store->capacity()*sizeof(int));
+    }
+    for(vector<size_t>* store : {&blocklevels, &active})
+    {
+        sizes.push_back(store->capacity()*sizeof(size_t));
+    }
+    sizes.push_back(listbudgets.capacity()*sizeof(T));
+    sizes.push_back(anchors.capacity()*sizeof(array<T,3>));
+    sizes.push_back((cachedlists.capacity() + cachedquads.capacity() + directblocks.capacity())*sizeof(vector<int>));
+    for(size_t b{0}; b < directblocks.size(); b++)
+    {
+        sizes.push_back(directblocks[b].capacity()*sizeof(int));
+    }
+    sizes.push_back(directaccelerations.capacity()*sizeof(array<T,3>));
+}
+
+/**
+ * @brief Bytes the main stores were reallocated to since storesbefore was taken. A store that was swapped with another keeps a size found in storesbefore, so only the sizes that are new are summed
+ * 
+ * @return size_t 
+ */
+template <typename T, typename K>
+size_t bodygen<T, K>::grownbytes()
+{
+    storesafter.clear();
+    storecapacities(storesafter);
+    sort(storesbefore.begin(), storesbefore.end());
+    sort(storesafter.begin(), storesafter.end());
+    size_t grown{0};
+    size_t k{0};
+    for(size_t i{0}; i < storesafter.size(); i++)
+    {
+        while(k < storesbefore.size() && storesbefore[k] < storesafter[i])
+        {
+            k = k + 1;
+        }
+        if(k < storesbefore.size() && storesbefore[k] == storesafter[i])
+        {
+            k = k + 1;
+        }
+        else
+        {
+            grown = grown + storesafter[i];
+        }
+    }
+    return(grown);
+}
+
+/**
+ * @brief Bytes held by the main stores of the simulation (see storecapacities) and the cached lists
+ * 
+ * @return size_t 
+ */
+template <typename T, typename K>
+size_t bodygen<T, K>::heldbytes()
+{
+    storesafter.clear();
+    storecapacities(storesafter);
+    size_t total{0};
+    for(size_t i{0}; i < storesafter.size(); i++)
+    {
+        total = total + storesafter[i];
+    }
+    for(size_t k{0}; k < cachedlists.size(); k++)
+    {
+        total = total + (cachedlists[k].capacity() + cachedquads[k].capacity())*sizeof(int);
+    }
+    return(total);
+}
+
+/**
+ * @brief Advances all bodies by one timestep with the drifts and kicks of scheme. The tree is updated before every kick, but collisions are only checked before the first one
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::symplecticstep()
+{
+    for(size_t stage{0}; stage < scheme.kicks.size(); stage++)
+    {
+        drift((T) scheme.drifts[stage]*timestep);
+        if(stage == 0)
+        {
+            maintaintree();
+        }
+        else
+        {
+            chrono::time_point start{chrono::steady_clock::now()};
+            const double boundsbefore = stats.bounds;
+            updatetree("none");
+            stats.build = stats.build + secondssince(start) - (stats.bounds - boundsbefore);
+        }
+        computeaccelerations();
+        kick((T) scheme.kicks[stage]*timestep);
+    }
+    drift((T) scheme.drifts.back()*timestep);
+}
+
+/**
+ * @brief Moves every body of the tree along its velocity for a time
+ * 
+ * @param time Length of the drift
+ */
+template <typename T, typename K>
+void bodygen<T, K>::drift(T time)
+{
+    for(size_t k{0}; k < treenodes.bodies.size(); k++)
+    {
+        body<T> &b = treenodes.bodies[k];
+        b.position = b.position + time*b.velocity;
+    }
+}
+
+/**
+ * @brief Changes the velocity of every body of the tree by its newacceleration over a time. newacceleration is moved into acceleration
+ * 
+ * @param time Length of the kick
+ */
+template <typename T, typename K>
+void bodygen<T, K>::kick(T time)
+{
+    for(size_t k{0}; k < treenodes.bodies.size(); k++)
+    {
+        body<T> &b = treenodes.bodies[k];
+        b.velocity = b.velocity + time*b.newacceleration;
+        b.acceleration = b.newacceleration;
+        b.newacceleration = {0,0,0};
+    }
+}
+
+/**
+ * @brief Gets the block timesteps going: the accelerations of all bodies are computed, and every body starts on the shortest step
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::startblocksteps()
+{
+    blocklevels.assign(treenodes.bodies.size(), options.blocksteps);
+    computeaccelerations();
+    for(size_t k{0}; k < treenodes.bodies.size(); k++)
+    {
+        body<T> &b = treenodes.bodies[k];
+        b.acceleration = b.newacceleration;
+        b.newacceleration = {0,0,0};
+    }
+}
+
+/**
+ * @brief Advances all bodies by one timestep with power-of-two block timesteps. A body on level l takes kick-drift-kick steps of timestep/2^l, and all bodies drift on every substep, but only the active bodies, whose step ends on the substep, get new accelerations.
+ * The tree is updated with maintaintree at the end of the timestep and when more than 1/blockrebuild of the bodies are active, and otherwise only refreshed.
+ * A body that ends a step picks a level whose step is at most options.blocketa*|a|/|j|, halving at most once and doubling only where the level above ends a step, so the levels stay in sync
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::blockstep()
+{
+    const size_t levels = options.blocksteps;
+    const size_t substeps = (size_t) 1 << levels;
+    const T subtimestep = timestep/(T) substeps;
+    for(size_t s{0}; s < substeps; s++)
+    {
+        for(size_t k{0}; k < treenodes.bodies.size(); k++)
+        {
+            body<T> &b = treenodes.bodies[k];
+            const size_t level = blocklevels[b.index];
+            const size_t stride = (size_t) 1 << (levels - level);
+            if(s % stride == 0)
+            {
+                const T step = timestep/(T) ((size_t) 1 << level);
+                b.velocity = b.velocity + ((T) 0.5*step)*b.acceleration;
+            }
+            b.position = b.position + subtimestep*b.velocity;
+        }
+        size_t activecount{0};
+        for(size_t k{0}; k < blocklevels.size(); k++)
+        {
+            if((s + 1) % ((size_t) 1 << (levels - blocklevels[k])) == 0)
+            {
+                activecount = activecount + 1;
+            }
+        }
+        if(activecount == 0)
+        {
+            continue;
+        }
+        if(s + 1 == substeps || activecount > blocklevels.size()/blockrebuild)
+        {
+            maintaintree();
+        }
+        else
+        {
+            chrono::time_point refreshstart{chrono::steady_clock::now()};
+            Spacetree<T> refresh_tree{space, treenodes, pool.get(), options.buildcutoff, options.leafsize, counters, options.collisions};
+            refresh_tree.refresh(datatree, false);
+            stats.build = stats.build + secondssince(refreshstart);
+        }
+        active.clear();
+        for(size_t k{0}; k < treenodes.bodies.size(); k++)
+        {
+            if((s + 1) % ((size_t) 1 << (levels - blocklevels[treenodes.bodies[k].index])) == 0)
+            {
+                active.push_back(k);
+            }
+        }
+        activeaccelerations();
+        for(size_t a{0}; a < active.size(); a++)
+        {
+            body<T> &b = treenodes.bodies[active[a]];
+            size_t &level = blocklevels[b.index];
+            const T step = timestep/(T) ((size_t) 1 << level);
+            b.velocity = b.velocity + ((T) 0.5*step)*b.newacceleration;
+            const T jerk = moodulus(b.newacceleration - b.acceleration)/step;
+            const T wanted = (jerk > 0) ? (T) options.blocketa*moodulus(b.newacceleration)/jerk : timestep;
+            size_t newlevel{0};
+            while(newlevel < levels && timestep/(T) ((size_t) 1 << newlevel) > wanted)
+            {
+                newlevel = newlevel + 1;
+            }
+            if(newlevel < level)
+            {
+                const size_t coarserstride = (size_t) 1 << (levels - level + 1);
+                newlevel = ((s + 1) % coarserstride == 0) ? level - 1 : level;
+            }
+            level = newlevel;
+            b.acceleration = b.newacceleration;
+            b.newacceleration = {0,0,0};
+        }
+    }
+}
+
+/**
+ * @brief Adds the acceleration of the active bodies (by their index in the bodies of treenodes) to their newacceleration, with one tree walk per body, after tuning options.theta if it is due. The time taken is added to stats
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::activeaccelerations()
+{
+    chrono::time_point start{chrono::steady_clock::now()};
+    if(options.errortarget > 0)
+    {
+        if(tunepasses % options.tuneevery == 0)
+        {
+            tunetheta();
+        }
+        tunepasses = tunepasses + 1;
+    }
+    fillmoments();
+    const bool quadrupoles = options.multipole == "quadrupole";
+    if(!pool)
+    {
+        for(size_t a{0}; a < active.size(); a++)
+        {
+            updatebodyacceleration(active[a], datatree, quadrupoles);
+        }
+    }
+    else
+    {
+        const size_t grain = active.size()/(8*pool->size()) + 1;
+        pool->parallelfor(active.size(), grain, [this, quadrupoles](size_t begin, size_t end)
+        {
+            for(size_t a{begin}; a < end; a++)
+            {
+                updatebodyacceleration(active[a], datatree, quadrupoles);
+            }
+        });
+    }
+    stats.force = stats.force + secondssince(start);
+}
+
+/**
+ * @brief Calculates the boundaries of a region
+ * 
+ * @return array<T,6> 
+ */
+template <typename T, typename K>
+array<T,6> bodygen<T, K>::calcminmax()
+{
+    array<T,6> minmax{0,0,0,0,0,0};
+    const vector<body<T>> &bodies = treenodes.bodies;
+    for(size_t i{0}; i < bodies.size(); i++)
+    {
+        size_t k2{0};
+        for(size_t k{0}; k < 3; k++)
+        {
+            if(bodies[i].position[k] < minmax[k2])
+            {
+                minmax[k2] = bodies[i].position[k];
+            }
+            else if(bodies[i].position[k] > minmax[k2+1])
+            {
+                minmax[k2+1] = bodies[i].position[k];
+            }
+            k2 = k2 + 2;
+        }
+    }
+    return(minmax);
+}
+
+/**
+ * @brief Randomly generates a set of coordinates within some annulus with inner radius r1 and outer radius r2
+ * 
+ * @param r1 Inner radius
+ * @param r2 Outer radius
+ * @return array<T,2> Returns the coordinates as array
+ */
+template <typename T, typename K>
+array<T,2> bodygen<T, K>::randcircgen(T r1, T r2)
+{
+    random_device rd;
+    mt19937_64 mt64(rd());
+    T scale = ((T) mt64())/((T) mt64.max());
+    T scale2 = ((T) mt64())/((T) mt64.max());
+    T scale3 = ((T) mt64())/((T) mt64.max());
+    T chosenr = r1 + (r2 - r1)*scale;
+    array<T, 2> xd = {0,0};
+    xd[0] = (2*scale3 - 1)*chosenr;
+    xd[1] = sgn(2*scale2 - 1)*sqrt(chosenr*chosenr - xd[0]*xd[0]);
+    return(xd);
+}
+
+/**
+ * @brief Randomly generates a set of coordinates within some spherical shell with inner radius r1 and outer radius r2
+ * 
+ * @param r1 Inner radius
+ * @param r2 Outer radius
+ * @return array<T,3> Returns coordinates of arrays
+ */
+template <typename T, typename K>
+array<T,3> bodygen<T, K>::randspheregen(T r1, T r2)
+{
+    random_device rd;
+    mt19937_64 mt64(rd());
+    T scale = ((T) mt64())/((T) mt64.max());
+    T scale2 = ((T) mt64())/((T) mt64.max());
+    T scale3 = ((T) mt64())/((T) mt64.max());
+    T scale4 = ((T) mt64())/((T) mt64.max());
+    T chosenr = r1 + (r2 - r1)*scale;
+    array<T, 3> xd = {0,0,0};
+    xd[0] = (2*scale2 - 1)*chosenr;
+    xd[1] = (2*scale3 - 1)*sqrt(chosenr*chosenr - xd[0]*xd[0]);
+    xd[2] = sgn(2*scale4 - 1)*sqrt(chosenr*chosenr - xd[0]*xd[0] - xd[1]*xd[1]);
+    return(xd);
+}
+
+/**
+ * @brief Generates body data. randpheregen and randcircgen are used to help generate random body data when needed. The uncommented code randomly generates bodies in some cube, while the commented code more elaborate generates bodies within some sphere or annulus with appropriate initial velocites such that they orbit, using the cross product. The bodies are generated straight into the store of the tree
+ * 
+ * @return int Returns the tree
+ */
+template <typename T, typename K>
+int bodygen<T, K>::makebodies()
+{
+    vector<body<T>> &bodyvector = treenodes.bodies;
+    bodyvector.resize(count);
+    ofstream datafile;
+    datafile.precision(30);
+    if(!snapshot<T>::isbinary(filename))
+    {
+        datafile.open(filename);
+    }
+    array<T, 8> randlist;
+    for(size_t i{0}; i < count; i++)
+    {
+        for(size_t j{0}; j < 8; j++)
+        {
+            random_device rd;
+            mt19937_64 mt64(rd());
+            randlist[j] = 2*((T) mt64()/((T) mt64.max())) - 1;
+        }
+        //array<T,3> spherevars = randspheregen(10, 1E7);
+        //array<T,2> circvars = randcircgen(1.2E9, 4E9);
+
+        //bodyvector[i].position = {spherevars[0], spherevars[1], spherevars[2]};
+        //bodyvector[i].position = {circvars[0], circvars[1], 1E5*randlist[2]};
+
+        //array<T,3> randrotvec = {randlist[0],randlist[1],randlist[2]};
+        //randrotvec = (1/moodulus(randrotvec))*randrotvec;
+        //array<T,3> perpvec = crossprod(bodyvector[i].position, randrotvec);
+        //perpvec = (1/moodulus(perpvec))*perpvec;
+        //const T extrafactor = sqrt(G*1E30/(moodulus(bodyvector[i].position)))/moodulus(bodyvector[i].position);
+
+        //bodyvector[i].velocity = crossprod(bodyvector[i].position,perpvec);
+        //bodyvector[i].velocity = extrafactor*bodyvector[i].velocity;
+        bodyvector[i].position = {(T) 10E15*randlist[0], (T) 10E15*randlist[1], (T) 10E15*randlist[2]};
+        bodyvector[i].velocity = {1000*randlist[3], 1000*randlist[4], 1000*randlist[5]};
+        bodyvector[i].mass = 3E30*(randlist[6]+1)/2;
+        bodyvector[i].radius = 1E9*(randlist[7]+1)/2;
+        bodyvector[i].index = i;
+
+
+        if(i == count - 1)
+        {
+            /*
+            bodyvector[i].position = {0,0,0};
+            bodyvector[i].velocity = {0,0,0};
+            bodyvector[i].mass = 1E40;
+            bodyvector[i].radius = 0;
+            bodyvector[i].index = i;
+            */
+            datafile << fixed << bodyvector[i];
+        }
+        else
+        {
+            datafile << fixed << bodyvector[i] << '\n';
+        }
+        
+    }
+    datafile.close();
+    if(snapshot<T>::isbinary(filename))
+    {
+        snapshot<T> initial;
+        initial.write(filename, bodyvector);
+    }
+    array<T,6> minimaxi = calcminmax();
+    space.xrange = {minimaxi[0] - 1,minimaxi[1] + 1};
+    space.yrange = {minimaxi[2] - 1,minimaxi[3] + 1};
+    space.zrange = {minimaxi[4] - 1,minimaxi[5] + 1};
+    Spacetree<T> space_tree{space, treenodes, pool.get(), options.buildcutoff, options.leafsize, counters, options.collisions};
+    return(space_tree.treegen());
+}
+
+/**
+ * @brief Determines whether or not the body "target" is under some node "tree". Every node covers a contiguous range of the Morton sorted bodies, so this is true exactly when target lies in the range of "tree"
+ * 
+ * @param target Index of the body in the bodies of treenodes
+ * @param tree Input Node
+ * @return true 
+ * @return false 
+ */
+template <typename T, typename K>
+bool bodygen<T, K>::comparetree(size_t target, int tree)
+{
+    return(target >= treenodes[tree].bodyrange[0] && target < treenodes[tree].bodyrange[1]);
+}
+
+/**
+ * @brief Finds the depth of the deepest leaf under a node
+ * 
+ * @param tree Input node
+ * @return size_t 0 if tree is a leaf
+ */
+template <typename T, typename K>
+size_t bodygen<T, K>::treedepth(int tree)
+{
+    size_t depth{0};
+    if(!treenodes[tree].isleaf)
+    {
+        for(size_t i{0}; i < 8; i++)
+        {
+            if(treenodes[tree].Nodelist[i] != nullnode)
+            {
+                depth = max(depth, treedepth(treenodes[tree].Nodelist[i]) + 1);
+            }
+        }
+    }
+    return(depth);
+}
+
+/**
+ * @brief Updates all the accelerations all leafs of the tree, found in one loop over the nodes under tree in depth first order (see Node::next)
+ * 
+ * @param tree Input node
+ * @param wholetree Input node
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes are summed too (options.multipole is "quadrupole")
+ */
+template <typename T, typename K>
+void bodygen<T, K>::updateallacceleration(int tree, int wholetree, bool quadrupoles)
+{
+    for(int node{tree}; node != treenodes[tree].next; node++)
+    {
+        if(treenodes[node].isleaf)
+        {
+            updatesingleacceleration(node, wholetree, quadrupoles);
+        }
+    }
+}
+
+/**
+ * @brief Collects the indices of all leaf nodes of a tree, in the same order updateallacceleration visits them
+ * 
+ * @param tree Input node
+ * @param leaflist Leaf indices are appended to this
+ */
+template <typename T, typename K>
+void bodygen<T, K>::collectleaves(int tree, vector<int> &leaflist)
+{
+    for(int node{tree}; node != treenodes[tree].next; node++)
+    {
+        if(treenodes[node].isleaf)
+        {
+            leaflist.push_back(node);
+        }
+    }
+}
+
+/**
+ * @brief Does the same as updateallacceleration, but the leaves are spread over the threads of pool. Every leaf only writes to its own bodies, so the result is the same as the serial one
+ * 
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes are summed too
+ */
+template <typename T, typename K>
+void bodygen<T, K>::parallelacceleration(bool quadrupoles)
+{
+    leaves.clear();
+    collectleaves(datatree, leaves);
+    const size_t grain = leaves.size()/(8*pool->size()) + 1;
+    pool->parallelfor(leaves.size(), grain, [this, quadrupoles](size_t begin, size_t end)
+    {
+        for(size_t k{begin}; k < end; k++)
+        {
+            updatesingleacceleration(leaves[k], datatree, quadrupoles);
+        }
+    });
+}
+
+/**
+ * @brief Builds the interaction list of a single body "target" in one loop over the nodes in depth first order. A node whose angular size is less than opening goes on the list as a whole and is skipped with everything under it, and the bodies of the leaves reached (other than target) go on it one by one
+ * 
+ * @param target Index of the body in the bodies of treenodes
+ * @param tree Input tree
+ * @param opening Opening angle the nodes are tested with, normally options.theta
+ * @param list Indices into nodemoments of the accepted nodes and bodies are appended to this
+ * @param quadlist With quadrupoles, the accepted nodes that are not leaves (and so have a quadrupole) are also appended to this
+ * @param quadrupoles Whether quadlist is filled. Decided once per pass by the caller from options.multipole
+ */
+template <typename T, typename K>
+void bodygen<T, K>::buildinteractionlist(size_t target, int tree, double opening, vector<int> &list, vector<int> &quadlist, bool quadrupoles)
+{
+    const size_t bodies = treenodes.size();
+    const size_t listed = list.size();
+    const size_t listcapacity = list.capacity();
+    const size_t quadcapacity = quadlist.capacity();
+    size_t visits{0};
+    const array<T,3> &position = treenodes.bodies[target].position;
+    const int end = treenodes[tree].next;
+    int current{tree};
+    while(current != end)
+    {
+        visits = visits + 1;
+        const Node<T> &node = treenodes[current];
+        if(node.isleaf)
+        {
+            for(size_t k{node.bodyrange[0]}; k < node.bodyrange[1]; k++)
+            {
+                if(k != target)
+                {
+                    list.push_back((int) (bodies + k));
+                }
+            }
+            current = node.next;
+        }
+        else if(!comparetree(target,current) && node.extent/(moodulus(position - node.cog)) < opening)
+        {
+            list.push_back(current);
+            if(quadrupoles)
+            {
+                quadlist.push_back(current);
+            }
+            current = node.next;
+        }
+        else
+        {
+            current = current + 1;
+        }
+    }
+    if(counters != NULL)
+    {
+        size_t grown{0};
+        grown = grown + ((list.capacity() != listcapacity) ? list.capacity()*sizeof(int) : 0);
+        grown = grown + ((quadlist.capacity() != quadcapacity) ? quadlist.capacity()*sizeof(int) : 0);
+        counters->addlist(visits, list.size() - listed, grown);
+    }
+}
+
+/**
+ * @brief Updates the accelerations of the bodies of a single leaf node "root" from the whole tree, one body at a time
+ * 
+ * @param root Input leaf node
+ * @param tree Input tree
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes are summed too
+ * @return int 
+ */
+template <typename T, typename K>
+int bodygen<T, K>::updatesingleacceleration(int root, int tree, bool quadrupoles)
+{
+    for(size_t target{treenodes[root].bodyrange[0]}; target < treenodes[root].bodyrange[1]; target++)
+    {
+        updatebodyacceleration(target, tree, quadrupoles);
+    }
+    return(root);
+}
+
+/**
+ * @brief Updates the acceleration of a single body "target" from the whole tree, summing the list of buildinteractionlist with the force kernel, and with quadrupolekernel if switched on
+ * 
+ * @param target Index of the body in the bodies of treenodes
+ * @param tree Input tree
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes are summed too
+ */
+template <typename T, typename K>
+void bodygen<T, K>::updatebodyacceleration(size_t target, int tree, bool quadrupoles)
+{
+    thread_local vector<int> interactions;
+    thread_local vector<int> quadlist;
+    interactions.clear();
+    quadlist.clear();
+    buildinteractionlist(target, tree, options.theta, interactions, quadlist, quadrupoles);
+    body<T> &b = treenodes.bodies[target];
+    array<T,3> acc = kernel(b.position, interactions, nodemoments);
+    if(!quadlist.empty())
+    {
+        acc = acc + quadrupolekernel<T,K>(b.position, quadlist, nodemoments);
+    }
+    for(size_t k{0}; k < 3; k++)
+    {
+        b.newacceleration[k] = b.newacceleration[k] + (T) G*acc[k];
+    }
+}
+
+/**
+ * @brief Collects the groups of the group walk: the topmost nodes with at most options.groupsize bodies, and the leaves that have more
+ * 
+ * @param tree Input node
+ * @param grouplist Group indices are appended to this
+ */
+template <typename T, typename K>
+void bodygen<T, K>::collectgroups(int tree, vector<int> &grouplist)
+{
+    int current{tree};
+    while(current != treenodes[tree].next)
+    {
+        const Node<T> &node = treenodes[current];
+        if(node.isleaf || node.bodyrange[1] - node.bodyrange[0] <= options.groupsize)
+        {
+            grouplist.push_back(current);
+            current = node.next;
+        }
+        else
+        {
+            current = current + 1;
+        }
+    }
+}
+
+/**
+ * @brief Builds one interaction list for all the bodies of the node "group", like buildinteractionlist but measuring the distance to the nearest point of the bounding box of the group, so a node accepted here is accepted by every body of the group. The group itself is left out
+ * 
+ * @param group Input group node
+ * @param tree Input tree
+ * @param box Bounding box of the bodies of group, as xmin, xmax, ymin, ymax, zmin, zmax
+ * @param opening Opening angle the nodes are tested with, normally options.theta
+ * @param list Indices into nodemoments of the accepted nodes and bodies are appended to this
+ * @param quadlist With quadrupoles, the accepted nodes that are not leaves are also appended to this
+ * @param quadrupoles Whether quadlist is filled, decided once per pass by the caller
+ */
+template <typename T, typename K>
+void bodygen<T, K>::buildgrouplist(int group, int tree, const array<T,6> &box, double opening, vector<int> &list, vector<int> &quadlist, bool quadrupoles)
+{
+    const size_t bodies = treenodes.size();
+    const size_t listed = list.size();
+    const size_t listcapacity = list.capacity();
+    const size_t quadcapacity = quadlist.capacity();
+    size_t visits{0};
+    const array<size_t,2> &range = treenodes[group].bodyrange;
+    const int end = treenodes[tree].next;
+    int current{tree};
+    while(current != end)
+    {
+        visits = visits + 1;
+        const Node<T> &node = treenodes[current];
+        if(node.bodyrange[0] >= range[0] && node.bodyrange[1] <= range[1])
+        {
+            current = node.next;
+            continue;
+        }
+        const bool holdsgroup = node.bodyrange[0] <= range[0] && range[1] <= node.bodyrange[1];
+        if(node.isleaf)
+        {
+            if(!holdsgroup)
             {
-                minmax[k2] = bodyvector[i].position[k];
+                for(size_t k{node.bodyrange[0]}; k < node.bodyrange[1]; k++)
+                {
+                    list.push_back((int) (bodies + k));
+                }
             }
-            else if(bodyvector[i].position[k] > minmax[k2+1])
+            current = node.next;
+            continue;
+        }
+        if(!holdsgroup)
+        {
+            array<T,3> gap = {0,0,0};
+            for(size_t k{0}; k < 3; k++)
             {
-                minmax[k2+1] = bodyvector[i].position[k];
+                gap[k] = max(max(box[2*k] - node.cog[k], node.cog[k] - box[2*k+1]), (T) 0);
+            }
+            if(node.extent/moodulus(gap) < opening)
+            {
+                list.push_back(current);
+                if(quadrupoles)
+                {
+                    quadlist.push_back(current);
+                }
+                current = node.next;
+                continue;
             }
-            k2 = k2 + 2;
         }
+        current = current + 1;
+    }
+    if(counters != NULL)
+    {
+        size_t grown{0};
+        grown = grown + ((list.capacity() != listcapacity) ? list.capacity()*sizeof(int) : 0);
+        grown = grown + ((quadlist.capacity() != quadcapacity) ? quadlist.capacity()*sizeof(int) : 0);
+        counters->addlist(visits, list.size() - listed, grown);
     }
-    return(minmax);
 }
 
 /**
- * @brief Randomly generates a set of coordinates within some annulus with inner radius r1 and outer radius r2
+ * @brief Bounding box of the bodies of a node
  * 
- * @param r1 Inner radius
- * @param r2 Outer radius
- * @return array<long double,2> Returns the coordinates as array
+ * @param group Input node
+ * @return array<T,6> The box as xmin, xmax, ymin, ymax, zmin, zmax
  */
-array<long double,2> bodygen::randcircgen(long double r1, long double r2)
+template <typename T, typename K>
+array<T,6> bodygen<T, K>::groupbox(int group)
 {
-    random_device rd;
-    mt19937_64 mt64(rd());
-    long double scale = ((long double) mt64())/((long double) mt64.max());
-    long double scale2 = ((long double) mt64())/((long double) mt64.max());
-    long double scale3 = ((long double) mt64())/((long double) mt64.max());
-    long double chosenr = r1 + (r2 - r1)*scale;
-    array<long double, 2> xd = {0,0};
-    xd[0] = (2*scale3 - 1)*chosenr;
-    xd[1] = sgn(2*scale2 - 1)*sqrt(chosenr*chosenr - xd[0]*xd[0]);
-    return(xd);
+    const size_t first = treenodes[group].bodyrange[0];
+    const size_t last = treenodes[group].bodyrange[1];
+    array<T,6> box;
+    for(size_t k{0}; k < 3; k++)
+    {
+        box[2*k] = treenodes.bodies[first].position[k];
+        box[2*k+1] = treenodes.bodies[first].position[k];
+    }
+    for(size_t target{first}; target < last; target++)
+    {
+        for(size_t k{0}; k < 3; k++)
+        {
+            box[2*k] = min(box[2*k], treenodes.bodies[target].position[k]);
+            box[2*k+1] = max(box[2*k+1], treenodes.bodies[target].position[k]);
+        }
+    }
+    return(box);
 }
 
 /**
- * @brief Randomly generates a set of coordinates within some spherical shell with inner radius r1 and outer radius r2
+ * @brief Updates the accelerations of the bodies of the node "group" from the whole tree with one walk. The list built by buildgrouplist is summed for every body of the group by sumgroupacceleration
  * 
- * @param r1 Inner radius
- * @param r2 Outer radius
- * @return array<long double,3> Returns coordinates of arrays
+ * @param group Input group node
+ * @param tree Input tree
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes are summed too
+ * @return int 
  */
-array<long double,3> bodygen::randspheregen(long double r1, long double r2)
+template <typename T, typename K>
+int bodygen<T, K>::updategroupacceleration(int group, int tree, bool quadrupoles)
 {
-    random_device rd;
-    mt19937_64 mt64(rd());
-    long double scale = ((long double) mt64())/((long double) mt64.max());
-    long double scale2 = ((long double) mt64())/((long double) mt64.max());
-    long double scale3 = ((long double) mt64())/((long double) mt64.max());
-    long double scale4 = ((long double) mt64())/((long double) mt64.max());
-    long double chosenr = r1 + (r2 - r1)*scale;
-    array<long double, 3> xd = {0,0,0};
-    xd[0] = (2*scale2 - 1)*chosenr;
-    xd[1] = (2*scale3 - 1)*sqrt(chosenr*chosenr - xd[0]*xd[0]);
-    xd[2] = sgn(2*scale4 - 1)*sqrt(chosenr*chosenr - xd[0]*xd[0] - xd[1]*xd[1]);
-    return(xd);
+    thread_local vector<int> interactions;
+    thread_local vector<int> quadlist;
+    interactions.clear();
+    quadlist.clear();
+    buildgrouplist(group, tree, groupbox(group), options.theta, interactions, quadlist, quadrupoles);
+    sumgroupacceleration(group, interactions, quadlist);
+    return(group);
 }
 
 /**
- * @brief Generates body data. randpheregen and randcircgen are used to help generate random body data when needed. The uncommented code randomly generates bodies in some cube, while the commented code more elaborate generates bodies within some sphere or annulus with appropriate initial velocites such that they orbit, using the cross product. The body data is then placed into a region, then placed into a tree
+ * @brief Adds the pull of an interaction list made by buildgrouplist, and of the other bodies of the group, to the newacceleration of every body of the node "group"
  * 
- * @return Node* Returns the tree
+ * @param group Input group node
+ * @param interactions Indices into nodemoments of the nodes and bodies on the list
+ * @param quadrupoles The nodes on the list that take part with their quadrupoles
  */
-Node* bodygen::makebodies()
+template <typename T, typename K>
+void bodygen<T, K>::sumgroupacceleration(int group, const vector<int> &interactions, const vector<int> &quadrupoles)
 {
-    bodyvector.resize(count);
-    ofstream datafile;
-    datafile.precision(30);
-    datafile.open(filename);
-    array<long double, 8> randlist;
-    for(size_t i{0}; i < count; i++)
+    thread_local vector<int> neighbours;
+    const size_t first = treenodes[group].bodyrange[0];
+    const size_t last = treenodes[group].bodyrange[1];
+    const size_t bodies = treenodes.size();
+    neighbours.clear();
+    for(size_t k{first + 1}; k < last; k++)
     {
-        for(size_t j{0}; j < 8; j++)
+        neighbours.push_back((int) (bodies + k));
+    }
+    for(size_t target{first}; target < last; target++)
+    {
+        //The list of the last target held every body of the group but it, in order. Putting it back in place of this target keeps that true
+        if(target > first)
         {
-            random_device rd;
-            mt19937_64 mt64(rd());
-            randlist[j] = 2*((long double) mt64()/((long double) mt64.max())) - 1;
+            neighbours[target - first - 1] = (int) (bodies + target - 1);
         }
-        //array<long double,3> spherevars = randspheregen(10, 1E7);
-        //array<long double,2> circvars = randcircgen(1.2E9, 4E9);
-
-        //bodyvector[i].position = {spherevars[0], spherevars[1], spherevars[2]};
-        //bodyvector[i].position = {circvars[0], circvars[1], 1E5*randlist[2]};
-
-        //array<long double,3> randrotvec = {randlist[0],randlist[1],randlist[2]};
-        //randrotvec = (1/moodulus(randrotvec))*randrotvec;
-        //array<long double,3> perpvec = crossprod(bodyvector[i].position, randrotvec);
-        //perpvec = (1/moodulus(perpvec))*perpvec;
-        //const long double extrafactor = sqrt(G*1E30/(moodulus(bodyvector[i].position)))/moodulus(bodyvector[i].position);
+        body<T> &b = treenodes.bodies[target];
+        array<T,3> acc = kernel(b.position, interactions, nodemoments);
+        acc = acc + kernel(b.position, neighbours, nodemoments);
+        if(!quadrupoles.empty())
+        {
+            acc = acc + quadrupolekernel<T,K>(b.position, quadrupoles, nodemoments);
+        }
+        for(size_t k{0}; k < 3; k++)
+        {
+            b.newacceleration[k] = b.newacceleration[k] + (T) G*acc[k];
+        }
+    }
+}
 
-        //bodyvector[i].velocity = crossprod(bodyvector[i].position,perpvec);
-        //bodyvector[i].velocity = extrafactor*bodyvector[i].velocity;
-        bodyvector[i].position = {10E15*randlist[0], 10E15*randlist[1], 10E15*randlist[2]};
-        bodyvector[i].velocity = {1000*randlist[3], 1000*randlist[4], 1000*randlist[5]};
-        bodyvector[i].mass = 3E30*(randlist[6]+1)/2;
-        bodyvector[i].radius = 1E9*(randlist[7]+1)/2;
-        bodyvector[i].index = i;
+/**
+ * @brief Updates the accelerations of all bodies with the group walk, spread over the threads of pool if there is one
+ * 
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes are summed too
+ */
+template <typename T, typename K>
+void bodygen<T, K>::groupacceleration(bool quadrupoles)
+{
+    groups.clear();
+    collectgroups(datatree, groups);
+    if(!pool)
+    {
+        for(size_t k{0}; k < groups.size(); k++)
+        {
+            updategroupacceleration(groups[k], datatree, quadrupoles);
+        }
+        return;
+    }
+    const size_t grain = groups.size()/(8*pool->size()) + 1;
+    pool->parallelfor(groups.size(), grain, [this, quadrupoles](size_t begin, size_t end)
+    {
+        for(size_t k{begin}; k < end; k++)
+        {
+            updategroupacceleration(groups[k], datatree, quadrupoles);
+        }
+    });
+}
 
+/**
+ * @brief Updates the accelerations of the bodies of the leaf listleaves[k] from its cached interaction list, making the list again first if the bodies have drifted too far for it.
+ * The list is made with the opening angle cachedopening*options.theta, which leaves every node on it a slack over the test of options.theta. If the bodies of the leaf have moved at most d and every body at most D since, the box of the leaf has come at most d + D closer and the extents have grown at most 4D, so the list is kept while d + (1 + 4/options.theta)*D is within its smallest slack
+ * 
+ * @param k Place of the leaf in listleaves
+ * @param maxdrift Largest distance of any body of the tree from its anchor
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes go on the cached lists
+ */
+template <typename T, typename K>
+void bodygen<T, K>::updatecachedleaf(size_t k, T maxdrift, bool quadrupoles)
+{
+    const int leaf = listleaves[k];
+    T leafdrift{0};
+    for(size_t target{treenodes[leaf].bodyrange[0]}; target < treenodes[leaf].bodyrange[1]; target++)
+    {
+        leafdrift = max(leafdrift, moodulus(treenodes.bodies[target].position - anchors[target]));
+    }
+    const T drift = leafdrift + (1 + 4/(T) options.theta)*maxdrift;
+    vector<int> &list = cachedlists[k];
+    vector<int> &quads = cachedquads[k];
+    if(drift > listbudgets[k])
+    {
+        list.clear();
+        quads.clear();
+        const array<T,6> box = groupbox(leaf);
+        buildgrouplist(leaf, datatree, box, (double) (cachedopening*options.theta), list, quads, quadrupoles);
+        T slack = numeric_limits<T>::max();
+        const size_t nodecount = treenodes.size();
+        for(size_t i{0}; i < list.size(); i++)
+        {
+            if((size_t) list[i] >= nodecount)
+            {
+                continue;
+            }
+            const Node<T> &node = treenodes[list[i]];
+            array<T,3> gap = {0,0,0};
+            for(size_t c{0}; c < 3; c++)
+            {
+                gap[c] = max(max(box[2*c] - node.cog[c], node.cog[c] - box[2*c+1]), (T) 0);
+            }
+            slack = min(slack, moodulus(gap) - node.extent/(T) options.theta);
+        }
+        listbudgets[k] = slack - drift;
+    }
+    else if(counters != NULL)
+    {
+        counters->addlist(0, list.size(), 0);
+    }
+    sumgroupacceleration(leaf, list, quads);
+}
 
-        if(i == count - 1)
+/**
+ * @brief Updates the accelerations of all bodies from interaction lists kept from one timestep to the next, one per leaf (see updatecachedleaf). All lists are made again when the tree has been updated properly. The leaves are spread over the threads of pool if there is one
+ * 
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes are summed too
+ */
+template <typename T, typename K>
+void bodygen<T, K>::cachedacceleration(bool quadrupoles)
+{
+    const vector<body<T>> &bodies = treenodes.bodies;
+    if(listleaves.empty())
+    {
+        collectleaves(datatree, listleaves);
+        cachedlists.resize(listleaves.size());
+        cachedquads.resize(listleaves.size());
+        listbudgets.assign(listleaves.size(), -1);
+        anchors.resize(bodies.size());
+        for(size_t k{0}; k < bodies.size(); k++)
         {
-            /*
-            bodyvector[i].position = {0,0,0};
-            bodyvector[i].velocity = {0,0,0};
-            bodyvector[i].mass = 1E40;
-            bodyvector[i].radius = 0;
-            bodyvector[i].index = i;
-            */
-            datafile << fixed << bodyvector[i];
+            anchors[k] = bodies[k].position;
         }
-        else
+    }
+    T maxdrift{0};
+    for(size_t k{0}; k < bodies.size(); k++)
+    {
+        maxdrift = max(maxdrift, moodulus(bodies[k].position - anchors[k]));
+    }
+    if(!pool)
+    {
+        for(size_t k{0}; k < listleaves.size(); k++)
         {
-            datafile << fixed << bodyvector[i] << '\n';
+            updatecachedleaf(k, maxdrift, quadrupoles);
         }
-        
+        return;
     }
-    datafile.close();
-    array<long double,6> minimaxi = calcminmax();
-    space.xrange = {minimaxi[0] - 1,minimaxi[1] + 1};
-    space.yrange = {minimaxi[2] - 1,minimaxi[3] + 1};
-    space.zrange = {minimaxi[4] - 1,minimaxi[5] + 1};
-    space.bodiesinregion = bodyvector;
-    Spacetree space_tree{space};
-    return(space_tree.treegen());
+    const size_t grain = listleaves.size()/(8*pool->size()) + 1;
+    pool->parallelfor(listleaves.size(), grain, [this, maxdrift, quadrupoles](size_t begin, size_t end)
+    {
+        for(size_t k{begin}; k < end; k++)
+        {
+            updatecachedleaf(k, maxdrift, quadrupoles);
+        }
+    });
 }
 
 /**
- * @brief Determines whether or not some node "root" is a child of some node "tree" by checking the nodepath of each node. Function is recursively called through all child nodes of "tree"
+ * @brief Sums the pull of every other body on every body of the tree directly, reading them from nodemoments. The sources are taken directblock bodies at a time, so a block stays in cache over a range of targets, and every sum goes over the blocks in the same order, so the result does not depend on the number of threads
  * 
- * @param root Input Node
- * @param tree Input Node
- * @return true 
- * @return false 
+ * @param sumkernel Force kernel the blocks are summed with
+ * @param accelerations Set to the acceleration of every body, by its index in the bodies of treenodes
  */
-bool bodygen::comparetree(Node* root, Node* tree)
+template <typename T, typename K>
+void bodygen<T, K>::directsum(forcekernel<T> sumkernel, vector<array<T,3>> &accelerations)
 {
-    if(root->nodepath == tree->nodepath)
+    const size_t n = treenodes.bodies.size();
+    const size_t nodecount = treenodes.size();
+    accelerations.resize(n);
+    directblocks.resize((n + directblock - 1)/directblock);
+    for(size_t b{0}; b < directblocks.size(); b++)
     {
-        return(true);
+        directblocks[b].clear();
+        for(size_t k{b*directblock}; k < min(n, (b + 1)*directblock); k++)
+        {
+            directblocks[b].push_back((int) (nodecount + k));
+        }
     }
-    else
+    auto sumrange = [this, sumkernel, &accelerations, n](size_t begin, size_t end)
     {
-        for(size_t i{0}; i < 8; i++)
+        thread_local vector<int> others;
+        for(size_t target{begin}; target < end; target++)
         {
-            if(tree->Nodelist[i] != NULL)
+            accelerations[target] = {0,0,0};
+        }
+        for(size_t b{0}; b < directblocks.size(); b++)
+        {
+            const size_t first = b*directblock;
+            const size_t last = min(n, first + directblock);
+            for(size_t target{begin}; target < end; target++)
             {
-                return(comparetree(root,tree->Nodelist[i]));
+                const array<T,3> &position = treenodes.bodies[target].position;
+                if(target < first || target >= last)
+                {
+                    accelerations[target] = accelerations[target] + sumkernel(position, directblocks[b], nodemoments);
+                    continue;
+                }
+                others.clear();
+                for(size_t k{first}; k < last; k++)
+                {
+                    if(k != target)
+                    {
+                        others.push_back(directblocks[b][k - first]);
+                    }
+                }
+                accelerations[target] = accelerations[target] + sumkernel(position, others, nodemoments);
             }
         }
-        return(false); 
+        for(size_t target{begin}; target < end; target++)
+        {
+            accelerations[target] = (T) G*accelerations[target];
+        }
+    };
+    if(!pool)
+    {
+        sumrange(0, n);
+        return;
     }
-    
+    const size_t grain = n/(8*pool->size()) + 1;
+    pool->parallelfor(n, grain, sumrange);
 }
 
 /**
- * @brief Updates all the accelerations all leafs of the tree recursively. Takes in two inputs since a function updatesingleacceleration is called which needs a leaf node and the whole tree as inputs
+ * @brief Adds the acceleration of every body of the tree, summed by directsum with the force kernel picked in options, to its newacceleration
  * 
- * @param tree Input node
- * @param wholetree Input node
- * @return Node* 
  */
-Node* bodygen::updateallacceleration(Node* tree, Node* wholetree)
+template <typename T, typename K>
+void bodygen<T, K>::directacceleration()
+{
+    directsum(kernel, directaccelerations);
+    for(size_t k{0}; k < treenodes.bodies.size(); k++)
+    {
+        body<T> &b = treenodes.bodies[k];
+        b.newacceleration = b.newacceleration + directaccelerations[k];
+    }
+}
+
+/**
+ * @brief Compares the newacceleration of every body to a direct sum done in T, and adds a row to errorrows: the step, the number of bodies, both times, and the rms, median, 99th percentile and largest relative error. In the mixed mode this includes the error of the float kernel
+ * 
+ * @param step Number of timesteps done, counting this one
+ */
+template <typename T, typename K>
+void bodygen<T, K>::reporterror(size_t step)
 {
-    if(tree == NULL)
+    const double enginetime = stats.force;
+    chrono::time_point start{chrono::steady_clock::now()};
+    fillmoments();
+    directsum(chooseforcekernel<T,T>("auto"), directaccelerations);
+    const double directtime = secondssince(start);
+    const size_t n = treenodes.bodies.size();
+    vector<double> errors(n, 0);
+    double squares{0};
+    for(size_t k{0}; k < n; k++)
     {
-        return(tree);
+        const T exact = moodulus(directaccelerations[k]);
+        if(exact > 0)
+        {
+            errors[k] = (double) (moodulus(treenodes.bodies[k].newacceleration - directaccelerations[k])/exact);
+        }
+        squares = squares + errors[k]*errors[k];
     }
-    if(tree->isleaf)
+    sort(errors.begin(), errors.end());
+    ostringstream row;
+    row << step << ',' << n << ',' << enginetime << ',' << directtime << ',';
+    if(n == 0)
     {
-        tree = updatesingleacceleration(tree,wholetree);
+        row << "0,0,0,0\n";
     }
     else
     {
-        for(size_t i{0}; i < 8; i++)
+        row << sqrt(squares/(double) n) << ',' << errors[n/2] << ',' << errors[(99*(n - 1))/100] << ',' << errors[n - 1] << '\n';
+    }
+    errorrows.append(row.str());
+}
+
+/**
+ * @brief Acceleration of a single body from the list the walk picked in options gives it: that of buildinteractionlist, or with the "group" walk or options.listreuse, that of buildgrouplist for the group of the body. nodemoments has to be filled
+ * 
+ * @param target Index of the body in the bodies of treenodes
+ * @param opening Opening angle
+ * @param quadrupoles Whether the quadrupoles of the accepted nodes are summed too
+ * @return array<T,3> The acceleration
+ */
+template <typename T, typename K>
+array<T,3> bodygen<T, K>::sampleacceleration(size_t target, double opening, bool quadrupoles)
+{
+    thread_local vector<int> interactions;
+    thread_local vector<int> quadlist;
+    interactions.clear();
+    quadlist.clear();
+    if(options.walk == "group" || options.listreuse > 0)
+    {
+        int group{datatree};
+        while(!treenodes[group].isleaf && (options.listreuse > 0 || treenodes[group].bodyrange[1] - treenodes[group].bodyrange[0] > options.groupsize))
+        {
+            for(size_t i{0}; i < 8; i++)
+            {
+                const int child = treenodes[group].Nodelist[i];
+                if(child != nullnode && treenodes[child].bodyrange[0] <= target && target < treenodes[child].bodyrange[1])
+                {
+                    group = child;
+                    break;
+                }
+            }
+        }
+        buildgrouplist(group, datatree, groupbox(group), opening, interactions, quadlist, quadrupoles);
+        for(size_t k{treenodes[group].bodyrange[0]}; k < treenodes[group].bodyrange[1]; k++)
         {
-            tree->Nodelist[i] = updateallacceleration(tree->Nodelist[i],wholetree);
+            if(k != target)
+            {
+                interactions.push_back((int) (treenodes.size() + k));
+            }
         }
     }
-    return(tree);
+    else
+    {
+        buildinteractionlist(target, datatree, opening, interactions, quadlist, quadrupoles);
+    }
+    const array<T,3> &position = treenodes.bodies[target].position;
+    array<T,3> acc = kernel(position, interactions, nodemoments);
+    if(!quadlist.empty())
+    {
+        acc = acc + quadrupolekernel<T,K>(position, quadlist, nodemoments);
+    }
+    return((T) G*acc);
 }
 
 /**
- * @brief Updates the acceleration of a single leaf node "root", recursively from the whole tree. If some node is far enough away and bodies span a small enough angular size, the leaf node sees a single mass at that node's center of gravity instead of a collection of bodies.
+ * @brief Sets options.theta to the largest opening angle from tunerange whose rms relative force error, on options.tunesample bodies picked at random and summed directly, is within options.errortarget. The angle is found by bisection, and the smallest one is taken if none meets the target. The walks of the tuning are not counted in stats
  * 
- * @param root Input leaf node
- * @param tree Input tree
- * @return Node* 
  */
-Node* bodygen::updatesingleacceleration(Node* root, Node* tree)
+template <typename T, typename K>
+void bodygen<T, K>::tunetheta()
 {
-    if(tree == NULL)
+    const size_t n = treenodes.bodies.size();
+    if(n < 2 || datatree == nullnode)
     {
-        return(root);
+        return;
+    }
+    stepstats* const keptcounters = counters;
+    counters = NULL;
+    fillmoments();
+    const size_t count = min(options.tunesample, n);
+    vector<size_t> sample(count);
+    mt19937_64 mt64(tunepasses);
+    uniform_int_distribution<size_t> pick(0, n - 1);
+    for(size_t s{0}; s < count; s++)
+    {
+        sample[s] = pick(mt64);
     }
-    if(!comparetree(root,tree) && (tree->extent/(moodulus(root->solebody.position - tree->cog)) < 0.3 or tree->isleaf))
+
+    const forcekernel<T> exactkernel = chooseforcekernel<T,T>("auto");
+    vector<array<T,3>> exact(count);
+    auto sumexact = [this, exactkernel, &sample, &exact, n](size_t begin, size_t end)
+    {
+        thread_local vector<int> others;
+        for(size_t s{begin}; s < end; s++)
+        {
+            others.clear();
+            for(size_t k{0}; k < n; k++)
+            {
+                if(k != sample[s])
+                {
+                    others.push_back((int) (treenodes.size() + k));
+                }
+            }
+            exact[s] = (T) G*exactkernel(treenodes.bodies[sample[s]].position, others, nodemoments);
+        }
+    };
+    vector<double> errors(count);
+    const bool quadrupoles = options.multipole == "quadrupole";
+    auto samplerror = [this, &sample, &exact, &errors, quadrupoles](double opening)
+    {
+        auto sumrange = [this, &sample, &exact, &errors, opening, quadrupoles](size_t begin, size_t end)
+        {
+            for(size_t s{begin}; s < end; s++)
+            {
+                const T size = moodulus(exact[s]);
+                errors[s] = (size > 0) ? (double) (moodulus(sampleacceleration(sample[s], opening, quadrupoles) - exact[s])/size) : 0;
+            }
+        };
+        if(pool)
+        {
+            pool->parallelfor(sample.size(), 1, sumrange);
+        }
+        else
+        {
+            sumrange(0, sample.size());
+        }
+        double squares{0};
+        for(size_t s{0}; s < errors.size(); s++)
+        {
+            squares = squares + errors[s]*errors[s];
+        }
+        return(sqrt(squares/(double) errors.size()));
+    };
+    if(pool)
     {
-        long double A = G*tree->cogmass/(moodulus(tree->cog - root->solebody.position)*moodulus(tree->cog - root->solebody.position)*moodulus(tree->cog - root->solebody.position));
-        array<long double,3> B = tree->cog - root->solebody.position;
-        root->solebody.newacceleration = root->solebody.newacceleration + A*B;
+        pool->parallelfor(count, 1, sumexact);
     }
     else
     {
-        for(size_t i{0}; i < 8; i++)
+        sumexact(0, count);
+    }
+
+    auto angle = [](size_t step)
+    {
+        return(tunerange[0]*pow(tunerange[1]/tunerange[0], (double) step/(double) (tunesteps - 1)));
+    };
+    size_t low{0};
+    size_t high{tunesteps - 1};
+    if(samplerror(angle(high)) <= options.errortarget)
+    {
+        low = high;
+    }
+    while(high - low > 1)
+    {
+        const size_t middle = (low + high)/2;
+        if(samplerror(angle(middle)) <= options.errortarget)
+        {
+            low = middle;
+        }
+        else
         {
-            root = updatesingleacceleration(root,tree->Nodelist[i]);
+            high = middle;
         }
     }
-    return(root);
+    const double tuned = angle(low);
+    if(tuned != options.theta && options.listreuse > 0)
+    {
+        listleaves.clear();
+    }
+    options.theta = tuned;
+    counters = keptcounters;
 }
 
 /**
- * @brief Updates the leaf nodes of the tree recursively, applying the velocity-verlet algorithm.
+ * @brief Copies the center of gravity, mass and quadrupole of every node of the tree into nodemoments, which is what the force kernels read, followed by the position and mass of every body of the tree
  * 
- * @param tree Input tree to update
- * @return Node* 
  */
-Node* bodygen::update(Node* tree)
+template <typename T, typename K>
+void bodygen<T, K>::fillmoments()
 {
-    if(tree == NULL)
+    const size_t nodecount = treenodes.size();
+    nodemoments.resize(nodecount + treenodes.bodies.size());
+    for(size_t i{0}; i < treenodes.size(); i++)
     {
-        return(tree);
+        const Node<T> &node = treenodes[(int) i];
+        nodemoments.x[i] = node.cog[0];
+        nodemoments.y[i] = node.cog[1];
+        nodemoments.z[i] = node.cog[2];
+        nodemoments.m[i] = node.cogmass;
+        nodemoments.qxx[i] = node.quadrupole[0];
+        nodemoments.qxy[i] = node.quadrupole[1];
+        nodemoments.qxz[i] = node.quadrupole[2];
+        nodemoments.qyy[i] = node.quadrupole[3];
+        nodemoments.qyz[i] = node.quadrupole[4];
+        nodemoments.qzz[i] = node.quadrupole[5];
     }
-    if(tree->isleaf)
+    for(size_t k{0}; k < treenodes.bodies.size(); k++)
     {
-        array<long double,3> sumacc = tree->solebody.acceleration + tree->solebody.newacceleration; 
-
-        tree->solebody.position = tree->solebody.position + timestep*tree->solebody.velocity + (0.5*timestep*timestep)*tree->solebody.acceleration;
-        tree->solebody.velocity = tree->solebody.velocity + (0.5*timestep)*sumacc;
-        tree->solebody.acceleration = tree->solebody.newacceleration;
-        tree->solebody.newacceleration = {0,0,0};
-        bodyvector[tree->solebody.index] = tree->solebody;
+        const body<T> &b = treenodes.bodies[k];
+        nodemoments.x[nodecount + k] = b.position[0];
+        nodemoments.y[nodecount + k] = b.position[1];
+        nodemoments.z[nodecount + k] = b.position[2];
+        nodemoments.m[nodecount + k] = b.mass;
     }
-    else
+}
+
+/**
+ * @brief Updates the bodies of the leaf nodes of the tree, applying the velocity-verlet algorithm. The bodies are updated where they are stored, in treenodes
+ * 
+ */
+template <typename T, typename K>
+void bodygen<T, K>::update()
+{
+    const int tree = datatree;
+    for(int node{tree}; node != treenodes[tree].next; node++)
     {
-        for(size_t i{0}; i < 8; i++)
+        if(!treenodes[node].isleaf)
+        {
+            continue;
+        }
+        for(size_t k{treenodes[node].bodyrange[0]}; k < treenodes[node].bodyrange[1]; k++)
         {
-            tree->Nodelist[i] = update(tree->Nodelist[i]);
+            body<T> &b = treenodes.bodies[k];
+            array<T,3> sumacc = b.acceleration + b.newacceleration; 
+
+            b.position = b.position + timestep*b.velocity + ((T) 0.5*timestep*timestep)*b.acceleration;
+            b.velocity = b.velocity + ((T) 0.5*timestep)*sumacc;
+            b.acceleration = b.newacceleration;
+            b.newacceleration = {0,0,0};
         }
     }
-    return(tree);
 }
 
+/**
+ * @brief The bodies of the simulation, in the Morton sorted order of the tree (see Nodearena). Their index says which body each one is
+ * 
+ * @return const vector<body<T>>& 
+ */
+template <typename T, typename K>
+const vector<body<T>>& bodygen<T, K>::getbodies()
+{
+    return(treenodes.bodies);
+}
 
+/*
+ * The templates are defined in this file, so every precision main.cpp can pick is instantiated here
+ */
+template class buildbuffers<float>;
+template class buildbuffers<double>;
+template class buildbuffers<long double>;
+template class Nodearena<float>;
+template class Nodearena<double>;
+template class Nodearena<long double>;
+template class pointmasses<float>;
+template class pointmasses<double>;
+template class pointmasses<long double>;
+template class collisiongrid<float>;
+template class collisiongrid<double>;
+template class collisiongrid<long double>;
+template class Spacetree<float>;
+template class Spacetree<double>;
+template class Spacetree<long double>;
+template class snapshot<float>;
+template class snapshot<double>;
+template class snapshot<long double>;
+template class snapshotwriter<float>;
+template class snapshotwriter<double>;
+template class snapshotwriter<long double>;
+template class fastmultipole<float>;
+template class fastmultipole<double>;
+template class fastmultipole<long double>;
+template forcekernel<float> chooseforcekernel<float,float>(const string &);
+template forcekernel<double> chooseforcekernel<double,double>(const string &);
+template forcekernel<long double> chooseforcekernel<long double,long double>(const string &);
+template forcekernel<double> chooseforcekernel<double,float>(const string &);
+template class bodygen<float,float>;
+template class bodygen<double,double>;
+template class bodygen<long double,long double>;
+template class bodygen<double,float>;
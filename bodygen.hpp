@@ -2,105 +2,614 @@
 #include <string>
 #include <array>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 using namespace std;
 
 /**
- * @brief Body class that stores the information of a body - position, velocity, acceleration, mass, and radius. Index keeps track of the body in updating "bodyvector" (in another class), and newacceleration is needed in Velocity-Verlet
+ * @brief Body class that stores the information of a body - position, velocity, acceleration, mass, and radius. Index identifies the body in the snapshots, and newacceleration is needed in Velocity-Verlet
  * 
+ * @tparam T Scalar type of the simulation: float, double or long double. The region, tree and force kernel classes below take it as well
  */
+template <typename T>
 class body
    {
         public:
-            array<long double, 3> position, velocity, acceleration, newacceleration;
-            long double mass, radius;
+            array<T, 3> position, velocity, acceleration, newacceleration;
+            T mass, radius;
             int index;
     };
 
 /**
- * @brief Region class stores boundaries of a region, a vector of bodies in the region, a nodepath and a boolean that checks if collisions have been computed
- * @param regnodepath This is a string that encodes the path one takes to reach some child node from the root node of the tree.
+ * @brief Region class stores boundaries of a region and a boolean that checks if collisions have been computed. The bodies themselves are kept in the Nodearena the tree is built in
  * @param checkcol This checks if collision has been computed. This is set to false initially, and set to true if collisions are checked, preventing needless extra computations at child nodes.
  */
+template <typename T>
 class region
     {   
         public:
-            array<long double, 2> xrange, yrange, zrange;
-            vector<body> bodiesinregion;
-            string regnodepath;
+            array<T, 2> xrange, yrange, zrange;
             bool checkcol;
     };
 
 /**
- * @brief Node struct that stores various elements - main important detail is that this Node points to eight other node pointers.
- * @param isleaf Is this node a leaf
- * @param nodepath Same as regnodepath from region. The way my code works requires this to exist in both the region class and the node struct
+ * @brief A file mapped read-only into memory (mmap, or a file mapping on Windows), so that it can be read without copying it through a stream first
+ * 
+ */
+class mappedfile
+{
+    public:
+        ~mappedfile();
+        bool open(const string &);
+        void close();
+        const unsigned char* data();
+        size_t size();
+    private:
+        const unsigned char* bytes{NULL};
+        size_t length{0};
+#ifdef _WIN32
+        void* filehandle{NULL};
+        void* maphandle{NULL};
+#endif
+};
+
+/**
+ * @brief Reads and writes the full state of the bodies. Files ending in .nbs (or .nbs.N) are binary, anything else is CSV in the format of the initial condition files.
+ * The binary format is little-endian: a 48 byte header ("NBODYSNP", version, precision, count, step, time and a reserved word), then the columns index, x, y, z, vx, vy, vz, mass and radius. Scalars take precision bytes: 4, 8, or 16 for long double wider than double, stored as two doubles whose sum is the value
+ * @param step Number of timesteps done when the snapshot was taken
+ * @param time Simulated time when the snapshot was taken
+ */
+template <typename T>
+class snapshot
+{
+    public:
+        size_t step{0};
+        double time{0};
+        static bool isbinary(const string &);
+        bool read(const string &, vector<body<T>> &);
+        bool write(const string &, const vector<body<T>> &);
+    private:
+        bool readbinary(const string &, vector<body<T>> &);
+        bool readcsv(const string &, vector<body<T>> &);
+        static bool ispermutation(const vector<body<T>> &);
+        bool writebinary(const string &, const vector<body<T>> &);
+        bool writecsv(const string &, const vector<body<T>> &);
+};
+
+/**
+ * @brief Writes snapshots on a background thread, so that the timestep loop does not wait for the disk. At most depth snapshots are queued, and their buffers are reused. Small text files (see stepstats) are queued with submittext
+ * @param queue Snapshots waiting to be written, oldest first
+ * @param freebuffers Buffers of written snapshots, kept so that their memory is reused
+ */
+template <typename T>
+class snapshotwriter
+{
+    public:
+        snapshotwriter(size_t);
+        ~snapshotwriter();
+        void submit(const string &, const vector<body<T>> &, size_t, double);
+        void submittext(const string &, string);
+        void finish();
+    private:
+        struct pending
+        {
+            string filename;
+            size_t step;
+            double time;
+            vector<body<T>> bodies;
+            string text;
+        };
+        size_t depth;
+        deque<pending> queue;
+        vector<vector<body<T>>> freebuffers;
+        bool writing{false};
+        bool stopping{false};
+        mutex lock;
+        condition_variable queued;
+        condition_variable written;
+        thread worker;
+        void workerloop();
+};
+
+/**
+ * @brief Index used in place of a child node when there is no child
+ * 
+ */
+const int nullnode{-1};
+
+/**
+ * @brief Node struct that stores various elements - main important detail is that this Node points to eight other nodes, by their index in a Nodearena.
+ * @param isleaf Is this node a leaf. A leaf holds up to a set number of bodies (see simoptions::leafsize)
+ * @param bodyrange Indices [first, last) of the Morton sorted bodies of the Nodearena covered by this node. A node is an ancestor of a body exactly when the body lies in this range
  * @param cog This is the center of gravity coordinates
  * @param cogmass Center of mass of the node
  * @param extent Approximate "size" or "spread" of bodies in a node
- * @param solebody The body stored in a node if it is a leaf. Otherwise this stores garbage data that will not be referenced
+ * @param quadrupole Traceless quadrupole moment of the bodies about cog, divided by cogmass so that it stays in the range of float, stored as xx, xy, xz, yy, yz, zz
+ * @param next Index of the first node after this node and all the nodes under it (see Spacetree::layout), which a walk goes to in order to skip them. Its first child is the node right after it
  * 
  */
+template <typename T>
 struct Node
 {
     bool isleaf;
-    string nodepath;
-    array<long double,3> cog;
-    long double cogmass;
-    long double extent;
-    body solebody;
-    array<Node*,8> Nodelist; 
+    array<size_t,2> bodyrange;
+    array<T,3> cog;
+    T cogmass;
+    T extent;
+    array<T,6> quadrupole;
+    array<int,8> Nodelist; 
+    int next;
 };
 
 /**
- * @brief A class that basically makes the tree
+ * @brief Broad phase of the collision detection. Bodies are put into a uniform grid of cells as wide as the largest body diameter, so that only bodies in neighbouring cells have to be checked against each other
+ * @param cells Key of the cell of each body, paired with the body's position in the range, sorted by key
+ * @param collided Flags the bodies that have already collided in this timestep
+ */
+template <typename T>
+class collisiongrid
+{
+    public:
+        size_t collide(vector<body<T>> &, size_t, size_t, bool);
+        size_t bytes();
+    private:
+        array<T,3> origin;
+        T cellsize;
+        vector<pair<unsigned long long, size_t>> cells;
+        vector<bool> collided;
+        array<long long,3> cellof(const array<T,3> &);
+        unsigned long long cellkey(const array<long long,3> &);
+};
+
+/**
+ * @brief Working storage of Spacetree, kept in the Nodearena between timesteps so that building or refitting a tree only allocates while the run grows
+ * @param mortonkeys Morton key of each body of the arena, kept in the same (sorted) order as the bodies
+ * @param keys Keys of the passes of Spacetree::sortbodies, swapped with tempkeys after each pass and with mortonkeys at the end
+ * @param order Old index of each body in the passes of Spacetree::sortbodies, swapped with temporder after each pass
+ * @param counts Bucket counts of one pass of Spacetree::sortbodies
+ * @param maxrads Largest body radius under each node, by node index, as left by refit
+ * @param extras Bodies put into leaves by refit, on top of the range of the leaf, chained per leaf from firstextra (by node index, or -1) through nextextra
+ * @param laidout The bodies laid out again in the order of the refitted tree, swapped with the bodies of the arena at the end of refit
+ * @param migrants Bodies that left their cells, taken out by Spacetree::removemigrants
+ * @param layoutorder Nodes in depth first order, made by Spacetree::layout from the nodes in pending
+ * @param grid Collision grid of Spacetree::updatecollision. The trees built in spares of the arena use the grids of the spares, so every parallel task has its own
+ */
+template <typename T>
+class buildbuffers
+{
+    public:
+        vector<unsigned long long> mortonkeys, keys, tempkeys;
+        vector<size_t> order, temporder, counts;
+        vector<T> maxrads;
+        vector<body<T>> extras, laidout, migrants;
+        vector<int> firstextra, nextextra, layoutorder, pending;
+        collisiongrid<T> grid;
+        void capacities(vector<size_t> &);
+};
+
+/**
+ * @brief Stores the nodes of a tree in one flat vector, indexed by node, which is kept between timesteps so that throwing away a tree is a reset
+ * @param nodes The storage for the nodes. Only grows, so after the first few timesteps no more memory is allocated
+ * @param used Number of nodes handed out since the last reset
+ * @param bodies The only copy of the bodies of the simulation, sorted by Morton key so that every node covers a contiguous range of them. Spares hold no bodies
+ * @param spares Spare arenas lent out by borrow, for building parts of a tree on other threads
+ * @param reordered Storage the nodes are moved into by reorder, then swapped with nodes
+ * @param newindex Index every node gets in reorder, by its old index
+ * @param buffers Working storage of the trees built in this arena. Spares lent out by borrow only use their grid
+ */
+template <typename T>
+class Nodearena
+{
+    public:
+        int allocate();
+        void reset();
+        size_t size();
+        int splice(Nodearena &);
+        void reorder(const vector<int> &);
+        Nodearena& borrow();
+        void giveback(Nodearena &);
+        void capacities(vector<size_t> &);
+        Node<T>& operator[](int);
+        vector<body<T>> bodies;
+        buildbuffers<T> buffers;
+    private:
+        vector<Node<T>> nodes;
+        size_t used{0};
+        vector<Node<T>> reordered;
+        vector<int> newindex;
+        vector<unique_ptr<Nodearena>> spares;
+        vector<Nodearena*> freespares;
+        mutex spareslock;
+};
+
+/**
+ * @brief Structure-of-arrays store of point masses: positions and masses in separate contiguous arrays, so that the force kernel can load several point masses into the lanes of one vector register
+ * @param qxx The six components of the quadrupole moment of each point mass (divided by its mass, see Node), for the quadrupole kernel
+ */
+template <typename T>
+class pointmasses
+{
+    public:
+        vector<T> x, y, z, m;
+        vector<T> qxx, qxy, qxz, qyy, qyz, qzz;
+        void resize(size_t);
+};
+
+/**
+ * @brief A force kernel. Returns the sum of m*(r - position)/|r - position|^3 (without G) over the point masses of a pointmasses store listed. Picked with chooseforcekernel
  * 
  */
+template <typename T>
+using forcekernel = array<T,3> (*)(const array<T,3> &, const vector<int> &, const pointmasses<T> &);
+
+/**
+ * @brief Picks a force kernel by name
+ * 
+ * @tparam T Scalar type of the positions and of the sums
+ * @tparam K Scalar type the rest of each interaction (distance, inverse cube) is computed in
+ */
+template <typename T, typename K>
+forcekernel<T> chooseforcekernel(const string &);
+
+/**
+ * @brief A work-stealing pool of threads, each with its own deque of tasks. The thread that creates the pool counts as one of the threads, and runs tasks while it waits
+ * @param queues One deque of tasks per thread. queues[0] belongs to the thread that created the pool
+ * @param queued Total number of tasks in all deques. Idle workers sleep on wakeup while this is zero
+ */
+class threadpool
+{
+    public:
+        threadpool(size_t);
+        ~threadpool();
+        size_t size();
+        void submit(function<void()>, atomic<size_t> &);
+        void wait(atomic<size_t> &);
+        void parallelfor(size_t, size_t, const function<void(size_t, size_t)> &);
+    private:
+        struct taskqueue
+        {
+            mutex lock;
+            deque<function<void()>> tasks;
+        };
+        vector<unique_ptr<taskqueue>> queues;
+        vector<thread> workers;
+        atomic<size_t> queued{0};
+        atomic<bool> stopping{false};
+        mutex sleeplock;
+        condition_variable wakeup;
+        bool runtask(size_t);
+        void workerloop(size_t);
+};
+
+/**
+ * @brief Fast multipole method: a dual tree walk adds the pull of well separated nodes to the local expansions of other nodes (M2L), which are then shifted down to the bodies (L2L and L2P). The multipoles are the moments made with the tree
+ * @param taskcutoff Nodes with more bodies than this split their work into parallel tasks, one per child, when there is a pool
+ * @param radius Largest distance of a body from the center of gravity, by node index
+ * @param nearfield Acceleration (without G) of each body from the bodies of the leaves too close to its own leaf to be paired as a whole, summed directly (P2P)
+ * @param field Acceleration (without G) at the center of gravity of each node, from the sources it has been paired with
+ * @param gradient Gradient of field, stored as xx, xy, xz, yy, yz, zz
+ * @param hessian Second derivatives of field, stored as xxx, xxy, xxz, xyy, xyz, xzz, yyy, yyz, yzz, zzz. Only used with quadrupoles
+ */
+template <typename T>
+class fastmultipole
+{
+    public:
+        void accelerations(Nodearena<T> &, int, threadpool*, double, bool);
+    private:
+        Nodearena<T>* nodes{NULL};
+        threadpool* pool{NULL};
+        size_t taskcutoff{0};
+        double theta{0.3};
+        bool quadrupoles{false};
+        vector<T> radius;
+        vector<array<T,3>> nearfield;
+        vector<array<T,3>> field;
+        vector<array<T,6>> gradient;
+        vector<array<T,10>> hessian;
+        void boundingradius(int);
+        void selfinteract(int);
+        void interact(int, int);
+        void celltocell(int, int);
+        void bodytobody(int, int);
+        void downward(int);
+};
+
+/**
+ * @brief Counters of one timestep, collected when simoptions::stats is on and written next to the snapshots (see bodygen::simulate). The times are wall times in seconds
+ * @param bounds Time spent finding the boundaries of the bodies for a new tree
+ * @param build Time spent building, refitting or refreshing the tree, including the collisions checked on the way
+ * @param force Time spent computing the accelerations
+ * @param write Time spent handing the snapshot to the writer thread
+ * @param collide Time spent checking collisions, in nanoseconds summed over the threads that checked them. The collisions are checked while the tree is built, so this is part of build
+ * @param collisionchecks Number of pairs of bodies whose distance was checked for a collision
+ * @param allocated Bytes the main stores and the interaction lists were reallocated to during the timestep (see bodygen::grownbytes)
+ * @param lists Number of interaction lists summed: one per body with the "body" walk, one per group or leaf with the others. Not counted by the "fmm" engine
+ * @param visits Number of nodes visited to make the lists. Lists kept from an earlier timestep (see simoptions::listreuse) take none
+ * @param interactions Number of nodes and bodies on the lists
+ * @param maxvisits Most visits of one list
+ * @param maxinteractions Most nodes and bodies on one list. When the walk degenerates toward a sum over all pairs, as it does in dense clusters, this grows toward the number of bodies
+ */
+class stepstats
+{
+    public:
+        void clear();
+        void addlist(size_t, size_t, size_t);
+        void addcollisions(size_t, long long);
+        double bounds{0};
+        double build{0};
+        double force{0};
+        double write{0};
+        atomic<long long> collide{0};
+        atomic<unsigned long long> allocated{0};
+        atomic<unsigned long long> collisionchecks{0};
+        atomic<unsigned long long> lists{0};
+        atomic<unsigned long long> visits{0};
+        atomic<unsigned long long> interactions{0};
+        atomic<unsigned long long> maxvisits{0};
+        atomic<unsigned long long> maxinteractions{0};
+};
+
+/**
+ * @brief A class that basically makes the tree, over the bodies of arena sorted in place by their Morton key in regi
+ * @param mortonkeys Morton key of each body of arena. It and maxrads, extras, firstextra, nextextra and laidout refer to the buffers of arena (see buildbuffers)
+ * @param pool Threads used to build the octants of large nodes in parallel. NULL builds the whole tree serially
+ * @param buildcutoff Nodes with more bodies than this build their octants as parallel tasks
+ * @param leafsize Nodes with at most this many bodies are made leaves
+ * @param relayout Whether refitnode lays the bodies out again into laidout (refit), or leaves them where they are (refresh)
+ * @param stats Counts the collision checks and their time, or NULL to count nothing
+ * @param checkcollisions Whether collisions are checked, which they are unless the collisions given to the constructor are "none"
+ * @param merge Whether colliding bodies merge into one (collisions "merge", see mergebodies) instead of bouncing off each other ("elastic")
+ */
+template <typename T>
 class Spacetree
 {
     public:
-        Spacetree(region);
-        Node* treegen();
+        Spacetree(region<T>, Nodearena<T> &, threadpool*, size_t, size_t, stepstats*, const string &);
+        int treegen();
+        int refit(int, size_t, size_t);
+        void refresh(int, bool);
+        int compact(int, vector<body<T>> &);
     private:
-        region regi;
-        Node* addnulls(Node*);
-        Node* makeatree(region);
-        vector<body> updatecollision(vector<body> &);
-        vector<body> mergebodies(vector<body> &);
+        region<T> regi;
+        Nodearena<T> &arena;
+        threadpool* pool;
+        size_t buildcutoff;
+        size_t leafsize;
+        vector<unsigned long long> &mortonkeys;
+        vector<T> &maxrads;
+        vector<body<T>> &extras;
+        vector<int> &firstextra;
+        vector<int> &nextextra;
+        vector<body<T>> &laidout;
+        bool relayout{false};
+        stepstats* stats;
+        bool checkcollisions;
+        bool merge;
+        int addnulls(Nodearena<T> &, int);
+        int makeatree(Nodearena<T> &, size_t, size_t, size_t, bool);
+        int layout(int);
+        T setmoments(Node<T> &, const vector<body<T>> &, size_t, size_t);
+        unsigned long long mortonkey(const body<T> &);
+        void sortbodies();
+        void updatecollision(collisiongrid<T> &, size_t, size_t);
+        bool inregion(const body<T> &);
+        int removemigrants(int, unsigned long long, size_t, vector<body<T>> &);
+        size_t bucketsize(int);
+        void addtoleaf(int, const body<T> &);
+        void insertbody(int, const body<T> &, size_t);
+        void refitnode(int, size_t, size_t &);
+        void refitcollisions(int, bool);
+        void setsubtreemoments(int);
+        vector<body<T>> mergebodies(vector<body<T>> &);
+        int compactnode(int, const vector<size_t> &);
+};
+
+/**
+ * @brief Optional settings of a run, given on the command line as --name value on top of the usual inputs
+ * @param threads Number of threads used to build the tree and compute the accelerations. With 1 everything runs serially on the calling thread
+ * @param buildcutoff Tree nodes with more bodies than this build their eight octants as parallel tasks (only if threads is more than 1)
+ * @param kernel Force kernel to use: "auto" (the widest the CPU supports), "scalar", "avx2" or "avx512"
+ * @param precision Scalar type of the run: "float", "double", "long" (long double) or "mixed" (double bodies, force kernel in float summed in double, for separations between about 1e-19 and 1e19)
+ * @param snapshots Format of the snapshots written every 100 steps: "csv" (positions and radii as text) or "binary" (the full state of the bodies, see snapshot)
+ * @param writequeue Number of snapshots that can wait for the writer thread before the timestep loop has to wait for it
+ * @param tree How the tree is kept up to date between timesteps: "rebuild" (a new tree every timestep) or "refit" (the tree is refitted in place, see Spacetree::refit)
+ * @param refitmigrants With "refit", the tree is rebuilt instead when more than this fraction of the bodies left their cells in one timestep
+ * @param theta Opening angle of the tree walk: a node is used as a whole when its extent divided by its distance is less than this
+ * @param multipole Moments of the nodes used in the force: "monopole" (mass at the center of gravity) or "quadrupole" (plus the quadrupole moment)
+ * @param engine How the accelerations are computed: "tree" (a Barnes-Hut walk), "fmm" (see fastmultipole) or "direct" (see bodygen::directsum, up to directmax bodies, "tree" above that)
+ * @param directmax With the "direct" engine, most bodies the accelerations are summed directly for. With more, the tree is walked instead
+ * @param errortarget With more than 0, theta is tuned as the run goes to keep the rms relative force error at most this (see bodygen::tunetheta). Not used with the "fmm" engine
+ * @param tuneevery With errortarget, theta is tuned again every tuneevery acceleration passes
+ * @param tunesample With errortarget, number of bodies the error is measured on
+ * @param errorreport Whether the forces of the steps with a snapshot are compared to a direct sum (see bodygen::reporterror). Only used with the "verlet" integrator and without block timesteps
+ * @param walk How the "tree" engine walks the tree: "body" (one walk per body) or "group" (one walk per group of nearby bodies, see bodygen::buildgrouplist)
+ * @param groupsize With the "group" walk, the nodes with at most this many bodies (or leaves, if those are larger) are the groups
+ * @param blocksteps With more than 0, bodies take block timesteps of timestep/2^l, for l from 0 to blocksteps, each picking the longest one it can (see bodygen::blockstep). 0 gives every body the same timestep
+ * @param blocketa With block timesteps, the step of a body is at most blocketa times its acceleration divided by the rate of change of its acceleration
+ * @param integrator How the bodies are moved every timestep: "verlet" (the Velocity-Verlet update), "leapfrog", "forestruth" (4th order) or "yoshida6" (6th order), see integrator. Not used with block timesteps
+ * @param leafsize Most bodies a leaf of the tree holds. The bodies of a leaf pull on each other, and on the bodies of the leaves that are too close to be taken as a whole, directly
+ * @param collisions What bodies that touch do: "elastic" (they bounce off each other) or "merge" (they merge into one body, see bodygen::compactbodies)
+ * @param listreuse With more than 0 (and the "tree" engine), the tree is only updated properly every listreuse times and the interaction lists are kept in between (see bodygen::cachedacceleration). Not used with block timesteps
+ * @param stats Whether the counters of every timestep (see stepstats) are collected and written next to the snapshots
+ */
+class simoptions
+{
+    public:
+        size_t threads{1};
+        size_t buildcutoff{1000};
+        string kernel{"auto"};
+        string precision{"long"};
+        string snapshots{"csv"};
+        size_t writequeue{2};
+        string tree{"rebuild"};
+        double refitmigrants{0.05};
+        double theta{0.3};
+        string multipole{"monopole"};
+        string engine{"tree"};
+        size_t directmax{500};
+        double errortarget{0};
+        size_t tuneevery{100};
+        size_t tunesample{64};
+        bool errorreport{false};
+        string walk{"body"};
+        size_t groupsize{32};
+        size_t blocksteps{0};
+        double blocketa{0.02};
+        string integrator{"verlet"};
+        size_t leafsize{1};
+        size_t listreuse{0};
+        string collisions{"elastic"};
+        bool stats{false};
+};
+
+/**
+ * @brief A symplectic integrator, as drifts (x += c*timestep*v) and kicks (v += d*timestep*a) taken in turn, starting and ending with a drift. The schemes are compositions of leapfrog steps: leapfrog itself, the 4th order Forest-Ruth scheme and Yoshida's 6th order scheme
+ * @param drifts Coefficients c of the drifts, one more than kicks
+ * @param kicks Coefficients d of the kicks
+ */
+class integrator
+{
+    public:
+        integrator(const string &);
+        vector<long double> drifts;
+        vector<long double> kicks;
 };
 
 /**
- * @brief The main class that runs the simulation or builds the bodies. Most paramters are straightforward
- * @param bodyvector This vector stores the information of all bodies in the simulation. When each leaf is updated, the corresponding index in this bodyvector is also updated
+ * @brief The main class that runs the simulation or builds the bodies. Most paramters are straightforward. The phases of a timestep, a whole timestep (step) and getbodies are public so bench.cpp and check.cpp can run them one at a time
+ * @param treenodes Storage for the nodes of the tree, reused every timestep, and the only store of the bodies (see Nodearena). datatree is the index of the root node
+ * @param builtdepth Depth of the tree when it was last rebuilt, to tell when refitting has made it too deep
+ * @param pool Threads used for the accelerations. Only created if options.threads is more than 1
+ * @param nodemoments Center of gravity and mass of every node of the tree, by node index, followed by those of every body of the tree, by its index in the bodies of treenodes, for the force kernel
+ * @param scheme Drifts and kicks of the symplectic integrator picked in options
+ * @param blocklevels Level of the block timestep of every body, by body index (see blockstep)
+ * @param active Bodies whose block timestep ends on the current substep, by their index in the bodies of treenodes
+ * @param writer Writes the snapshots in the background while the simulation goes on
+ * @param fmm Computes the accelerations when options.engine is "fmm"
+ * @param treeage With options.listreuse, number of times the tree has been refreshed since it was last updated properly
+ * @param listleaves With options.listreuse, the leaves of the tree the cached lists belong to. Empty when the lists have to be made again from scratch
+ * @param cachedlists Interaction list of every leaf of listleaves, by its place in listleaves, as made by buildgrouplist
+ * @param cachedquads Accepted nodes of cachedlists that take part with their quadrupoles
+ * @param listbudgets How far the bodies can drift, by the measure of cachedacceleration, before the cached list of every leaf of listleaves has to be made again
+ * @param anchors Position of every body of the tree (by its index in the bodies of treenodes) when listleaves was collected, which the drift of the bodies is measured from
+ * @param stats Counters of the current timestep. The times are always kept, the counts only when options.stats is on, through counters (NULL otherwise)
+ * @param statsrows Rows of stats of the timesteps since the last snapshot, in the format of writestats
+ * @param directblocks Indices into nodemoments of the bodies of the tree, in blocks of directblock bodies, for directsum
+ * @param directaccelerations Accelerations summed by directsum, by index in the bodies of treenodes
+ * @param errorrows Rows of the errors found by reporterror, written when the simulation ends
+ * @param tunepasses With options.errortarget, number of acceleration passes since the run started, which decides when tunetheta is run and seeds its sample
+ * @param storesbefore Bytes held by each main store when the timestep started, for grownbytes. Only taken when options.stats is on
+ * @param storesafter The same when the timestep ended
  * 
+ * @tparam T Scalar type of the bodies and the tree
+ * @tparam K Scalar type the force kernel computes each interaction in. The same as T, except in the mixed precision mode (T = double, K = float)
  */
+template <typename T, typename K = T>
 class bodygen
 {
     private:
-        Node* update(Node*);
-        Node* makebodies();
-        Node* updatesingleacceleration(Node*, Node*);
-        Node* updateallacceleration(Node*, Node*);
-        void deletetree(Node*);
-
-        bool comparetree(Node*, Node*);
-        array<long double,6> calcminmax();
-        array<long double,2> randcircgen(long double, long double);
-        array<long double,3> randspheregen(long double, long double);
+        int makebodies();
+        int updatesingleacceleration(int, int, bool);
+        void updatebodyacceleration(size_t, int, bool);
+        void buildinteractionlist(size_t, int, double, vector<int> &, vector<int> &, bool);
+        void fillmoments();
+        void updateallacceleration(int, int, bool);
+
+        void symplecticstep();
+        void drift(T);
+        void kick(T);
+
+        void startblocksteps();
+        void blockstep();
+        void activeaccelerations();
+
+        void collectleaves(int, vector<int> &);
+        void parallelacceleration(bool);
+
+        void collectgroups(int, vector<int> &);
+        void buildgrouplist(int, int, const array<T,6> &, double, vector<int> &, vector<int> &, bool);
+        array<T,6> groupbox(int);
+        void sumgroupacceleration(int, const vector<int> &, const vector<int> &);
+        int updategroupacceleration(int, int, bool);
+        void groupacceleration(bool);
+
+        void updatecachedleaf(size_t, T, bool);
+        void cachedacceleration(bool);
+
+        void updatetree(const string &);
+        void rebuildtree(const string &);
+        void compactbodies();
+        void directsum(forcekernel<T>, vector<array<T,3>> &);
+        void directacceleration();
+        void reporterror(size_t);
+        array<T,3> sampleacceleration(size_t, double, bool);
+        void tunetheta();
+        void recordstats(size_t, double);
+        void writestats(const string &);
+        void storecapacities(vector<size_t> &);
+        size_t grownbytes();
+        size_t heldbytes();
+
+        bool comparetree(size_t, int);
+        size_t treedepth(int);
+        array<T,6> calcminmax();
+        array<T,2> randcircgen(T, T);
+        array<T,3> randspheregen(T, T);
         
         size_t count{100};
         string filename;
-        long double timestep{1};
+        T timestep{1};
         size_t iterations{100};
 
-        Node* datatree;
-        region space;
+        int datatree;
+        size_t builtdepth{0};
+        Nodearena<T> treenodes;
+        region<T> space;
         bool writeinitfile;
-        vector<body> bodyvector;
+        simoptions options;
+        unique_ptr<threadpool> pool;
+        pointmasses<T> nodemoments;
+        fastmultipole<T> fmm;
+        forcekernel<T> kernel{chooseforcekernel<T,K>("auto")};
+        vector<int> leaves;
+        vector<int> groups;
+        vector<size_t> blocklevels;
+        vector<size_t> active;
+        integrator scheme{"leapfrog"};
+        size_t treeage{0};
+        vector<int> listleaves;
+        vector<vector<int>> cachedlists;
+        vector<vector<int>> cachedquads;
+        vector<T> listbudgets;
+        vector<array<T,3>> anchors;
+        unique_ptr<snapshotwriter<T>> writer;
+        stepstats stats;
+        stepstats* counters{NULL};
+        string statsrows;
+        vector<vector<int>> directblocks;
+        vector<array<T,3>> directaccelerations;
+        string errorrows;
+        size_t tunepasses{0};
+        vector<size_t> storesbefore;
+        vector<size_t> storesafter;
     public:
-        bodygen(string, long double, size_t);
-        bodygen(size_t, string, long double, size_t);
+        bodygen(string, T, size_t);
+        bodygen(size_t, string, T, size_t);
+        bool setoptions(const simoptions &);
         void simulate();
+
+        void setbodies(const vector<body<T>> &);
+        void step();
+        void computeaccelerations();
+        void update();
+        void maintaintree();
+        const vector<body<T>>& getbodies();
 };
 
 
@@ -15,22 +15,387 @@
 #include <chrono>
 #include <cmath>
 #include <fstream>
+#include <string>
 
 #include "bodygen.hpp"
 
 
 using namespace std;
 
+/**
+ * @brief Runs the simulation with bodies of scalar type T and the force kernel working in K, then prints the elapsed time
+ * 
+ * @param count Number of bodies to generate, or 0 to read them from filename
+ * @param filename Input file if count is 0, otherwise the file the generated bodies are written to
+ * @param timestep Timestep
+ * @param iterations Number of iterations
+ * @param options Optional settings of the run
+ * @param start_time When the program started
+ */
+template <typename T, typename K>
+void runsimulation(size_t count, string filename, long double timestep, size_t iterations, const simoptions &options, chrono::steady_clock::time_point start_time)
+{
+    unique_ptr<bodygen<T,K>> gen;
+    if(count == 0)
+    {
+        gen = make_unique<bodygen<T,K>>(filename, (T) timestep, iterations);
+    }
+    else
+    {
+        gen = make_unique<bodygen<T,K>>(count, filename, (T) timestep, iterations);
+    }
+    if(!gen->setoptions(options))
+    {
+        std::cout << "Invalid inputs detected - --kernel " << options.kernel << " is not supported by this CPU at --precision " << options.precision << ".\n";
+        return;
+    }
+    gen->simulate();
+    chrono::time_point end_time{chrono::steady_clock::now()};
+    chrono::duration<double> elapsed_time_seconds{end_time - start_time};
+    cout << "Elapsed time: " << elapsed_time_seconds.count() << " seconds, ";
+}
+
+/**
+ * @brief Picks the scalar types of the run from options.precision and runs the simulation
+ * 
+ * @param count Number of bodies to generate, or 0 to read them from filename
+ * @param filename Input or output file
+ * @param timestep Timestep
+ * @param iterations Number of iterations
+ * @param options Optional settings of the run
+ * @param start_time When the program started
+ */
+void runsimulation(size_t count, string filename, long double timestep, size_t iterations, const simoptions &options, chrono::steady_clock::time_point start_time)
+{
+    if(options.precision == "float")
+    {
+        runsimulation<float,float>(count, filename, timestep, iterations, options, start_time);
+    }
+    else if(options.precision == "double")
+    {
+        runsimulation<double,double>(count, filename, timestep, iterations, options, start_time);
+    }
+    else if(options.precision == "mixed")
+    {
+        runsimulation<double,float>(count, filename, timestep, iterations, options, start_time);
+    }
+    else
+    {
+        runsimulation<long double,long double>(count, filename, timestep, iterations, options, start_time);
+    }
+}
+
 /**
  * @brief The main function. Runs the Spacetree and bodygen constructors and the simulate function based on inputs. Also checks for correct inputs and returns error messages if command line inputs are incorrect.
+ * Options of the form --name value may be given anywhere, and are taken out of argv before the other inputs are checked:
+ *  --threads N       build the tree and compute the accelerations with N threads
+ *  --buildcutoff N   tree nodes with more than N bodies build their octants in parallel
+ *  --kernel NAME     force kernel: auto, scalar, avx2 or avx512
+ *  --precision NAME  scalar type of the run: float, double, long (long double, the default) or mixed
+ *  --snapshots NAME  format of the snapshots written every 100 steps: csv (the default) or binary
+ *  --writequeue N    number of snapshots that can wait for the background writer before the simulation waits for it
+ *  --tree NAME       rebuild the tree every timestep (rebuild, the default) or refit it in place (refit)
+ *  --refitmigrants F with --tree refit, rebuild when more than this fraction of the bodies change cells in a timestep
+ *  --collisions NAME bodies that touch bounce off each other (elastic, the default) or merge into one body (merge), which takes the absorbed bodies out of the later snapshots
+ *  --theta X         opening angle of the tree walk (0.3 by default)
+ *  --errortarget X   tune the opening angle as the run goes to the largest one whose rms relative force error on a sample of bodies is at most X (0, the default, keeps --theta)
+ *  --tuneevery N     with --errortarget, tune again every N acceleration passes (100 by default)
+ *  --tunesample N    with --errortarget, number of bodies the error is measured on (64 by default)
+ *  --multipole NAME  moments of the nodes used in the force: monopole (the default) or quadrupole
+ *  --engine NAME     how the accelerations are computed: tree (a Barnes-Hut walk per body, the default), fmm (fast multipole method) or direct (a sum over every pair of bodies, up to --directmax bodies)
+ *  --directmax N     with --engine direct, most bodies summed directly (500 by default). With more bodies the tree is walked instead
+ *  --errorreport NAME on compares the accelerations of the steps a snapshot is written on to a direct sum and writes the errors to filename.forceerror.csv, off (the default) does not
+ *  --walk NAME       with --engine tree, walk the tree once per body (body, the default) or once per group of nearby bodies (group)
+ *  --groupsize N     with --walk group, most bodies in a group (32 by default)
+ *  --blocksteps N    let each body take steps of timestep/2^l for l up to N, picked from how fast its acceleration changes (0, the default, gives every body the same step). Not with --integrator, --engine, --walk, --listreuse or --errorreport
+ *  --blocketa X      with --blocksteps, a body's step is at most X times its acceleration over the rate of change of its acceleration (0.02 by default)
+ *  --integrator NAME how the bodies are moved every timestep: verlet (the default), leapfrog, forestruth (4th order) or yoshida6 (6th order)
+ *  --leafsize N      most bodies a leaf of the tree holds (1 by default). The bodies of nearby leaves pull on each other directly
+ *  --listreuse N     with --engine tree, update the tree properly only every N timesteps and keep the interaction list of every leaf until its bodies drift too far (0, the default, walks the tree every timestep)
+ *  --stats NAME      on writes the timings and counters of every timestep next to the snapshots as filename.stats.csv.N, off (the default) does not
+ *  --convert FILE    instead of running a simulation, convert the single input file between CSV and the binary snapshot format (.nbs)
  * 
- * @param argc Number of inputs - must be 3 or 4 (in addition to ./bodygen.exe)
+ * @param argc Number of inputs - must be 3 or 4 (in addition to ./bodygen.exe and any options)
  * @param argv The inputs
  * @return int 
  */
 int main(int argc, char* argv[])
 {
     chrono::time_point start_time{chrono::steady_clock::now()};
+    simoptions options;
+    string convertto;
+    int nargs{1};
+    for(int i{1}; i < argc; i++)
+    {
+        string arg = (string) argv[i];
+        if(arg.substr(0, 2) != "--")
+        {
+            argv[nargs] = argv[i];
+            nargs = nargs + 1;
+            continue;
+        }
+        if(i + 1 == argc)
+        {
+            std::cout << "Missing value for option " << arg << "\n";
+            return 0;
+        }
+        string value = (string) argv[i+1];
+        i = i + 1;
+        if(arg == "--threads")
+        {
+            if(atoi(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - --threads takes a positive integer.\n";
+                return 0;
+            }
+            options.threads = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--buildcutoff")
+        {
+            if(atoi(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - --buildcutoff takes a positive integer.\n";
+                return 0;
+            }
+            options.buildcutoff = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--kernel")
+        {
+            if(value != "auto" && value != "scalar" && value != "avx2" && value != "avx512")
+            {
+                std::cout << "Invalid inputs detected - --kernel takes auto, scalar, avx2 or avx512.\n";
+                return 0;
+            }
+            options.kernel = value;
+        }
+        else if(arg == "--snapshots")
+        {
+            if(value != "csv" && value != "binary")
+            {
+                std::cout << "Invalid inputs detected - --snapshots takes csv or binary.\n";
+                return 0;
+            }
+            options.snapshots = value;
+        }
+        else if(arg == "--writequeue")
+        {
+            if(atoi(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - --writequeue takes a positive integer.\n";
+                return 0;
+            }
+            options.writequeue = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--tree")
+        {
+            if(value != "rebuild" && value != "refit")
+            {
+                std::cout << "Invalid inputs detected - --tree takes rebuild or refit.\n";
+                return 0;
+            }
+            options.tree = value;
+        }
+        else if(arg == "--collisions")
+        {
+            if(value != "elastic" && value != "merge")
+            {
+                std::cout << "Invalid inputs detected - --collisions takes elastic or merge.\n";
+                return 0;
+            }
+            options.collisions = value;
+        }
+        else if(arg == "--refitmigrants")
+        {
+            if(atof(value.c_str()) < 0 || atof(value.c_str()) > 1)
+            {
+                std::cout << "Invalid inputs detected - --refitmigrants takes a number between 0 and 1.\n";
+                return 0;
+            }
+            options.refitmigrants = atof(value.c_str());
+        }
+        else if(arg == "--theta")
+        {
+            if(atof(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - --theta takes a positive number.\n";
+                return 0;
+            }
+            options.theta = atof(value.c_str());
+        }
+        else if(arg == "--errortarget")
+        {
+            if(atof(value.c_str()) < 0)
+            {
+                std::cout << "Invalid inputs detected - --errortarget takes a non-negative number.\n";
+                return 0;
+            }
+            options.errortarget = atof(value.c_str());
+        }
+        else if(arg == "--tuneevery" || arg == "--tunesample")
+        {
+            if(atoi(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - " << arg << " takes a positive integer.\n";
+                return 0;
+            }
+            size_t &target = (arg == "--tuneevery") ? options.tuneevery : options.tunesample;
+            target = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--multipole")
+        {
+            if(value != "monopole" && value != "quadrupole")
+            {
+                std::cout << "Invalid inputs detected - --multipole takes monopole or quadrupole.\n";
+                return 0;
+            }
+            options.multipole = value;
+        }
+        else if(arg == "--engine")
+        {
+            if(value != "tree" && value != "fmm" && value != "direct")
+            {
+                std::cout << "Invalid inputs detected - --engine takes tree, fmm or direct.\n";
+                return 0;
+            }
+            options.engine = value;
+        }
+        else if(arg == "--directmax")
+        {
+            if(atoi(value.c_str()) < 0)
+            {
+                std::cout << "Invalid inputs detected - --directmax takes a non-negative integer.\n";
+                return 0;
+            }
+            options.directmax = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--errorreport")
+        {
+            if(value != "on" && value != "off")
+            {
+                std::cout << "Invalid inputs detected - --errorreport takes on or off.\n";
+                return 0;
+            }
+            options.errorreport = (value == "on");
+        }
+        else if(arg == "--walk")
+        {
+            if(value != "body" && value != "group")
+            {
+                std::cout << "Invalid inputs detected - --walk takes body or group.\n";
+                return 0;
+            }
+            options.walk = value;
+        }
+        else if(arg == "--groupsize")
+        {
+            if(atoi(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - --groupsize takes a positive integer.\n";
+                return 0;
+            }
+            options.groupsize = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--blocksteps")
+        {
+            if(atoi(value.c_str()) < 0 || atoi(value.c_str()) > 30)
+            {
+                std::cout << "Invalid inputs detected - --blocksteps takes an integer from 0 to 30.\n";
+                return 0;
+            }
+            options.blocksteps = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--blocketa")
+        {
+            if(atof(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - --blocketa takes a positive number.\n";
+                return 0;
+            }
+            options.blocketa = atof(value.c_str());
+        }
+        else if(arg == "--integrator")
+        {
+            if(value != "verlet" && value != "leapfrog" && value != "forestruth" && value != "yoshida6")
+            {
+                std::cout << "Invalid inputs detected - --integrator takes verlet, leapfrog, forestruth or yoshida6.\n";
+                return 0;
+            }
+            options.integrator = value;
+        }
+        else if(arg == "--leafsize")
+        {
+            if(atoi(value.c_str()) <= 0)
+            {
+                std::cout << "Invalid inputs detected - --leafsize takes a positive integer.\n";
+                return 0;
+            }
+            options.leafsize = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--listreuse")
+        {
+            if(atoi(value.c_str()) < 0)
+            {
+                std::cout << "Invalid inputs detected - --listreuse takes a non-negative integer.\n";
+                return 0;
+            }
+            options.listreuse = (size_t) atoi(value.c_str());
+        }
+        else if(arg == "--stats")
+        {
+            if(value != "on" && value != "off")
+            {
+                std::cout << "Invalid inputs detected - --stats takes on or off.\n";
+                return 0;
+            }
+            options.stats = (value == "on");
+        }
+        else if(arg == "--convert")
+        {
+            convertto = value;
+        }
+        else if(arg == "--precision")
+        {
+            if(value != "float" && value != "double" && value != "long" && value != "mixed")
+            {
+                std::cout << "Invalid inputs detected - --precision takes float, double, long or mixed.\n";
+                return 0;
+            }
+            options.precision = value;
+        }
+        else
+        {
+            std::cout << "Unknown option " << arg << "\n";
+            return 0;
+        }
+    }
+    argc = nargs;
+    if(options.blocksteps > 0 && (options.integrator != "verlet" || options.engine != "tree" || options.walk != "body" || options.listreuse > 0 || options.errorreport))
+    {
+        std::cout << "Invalid inputs detected - --blocksteps cannot be combined with --integrator, --engine, --walk, --listreuse or --errorreport.\n";
+        return 0;
+    }
+    if(!convertto.empty())
+    {
+        if(argc != 2)
+        {
+            std::cout << "Incorrect number of inputs - --convert takes a single input file\n";
+            return 0;
+        }
+        vector<body<long double>> bodies;
+        snapshot<long double> state;
+        if(!state.read(argv[1], bodies))
+        {
+            std::cout << "Could not read " << argv[1] << "\n";
+            return 0;
+        }
+        if(!state.write(convertto, bodies))
+        {
+            std::cout << "Could not write " << convertto << "\n";
+            return 0;
+        }
+        std::cout << "Converted " << bodies.size() << " bodies from " << argv[1] << " to " << convertto << "\n";
+        return 0;
+    }
     if(argc > 5 or argc < 4)
     {
         std::cout << "Incorrect number of inputs\n";
@@ -59,12 +424,7 @@ int main(int argc, char* argv[])
                 string str = (string) argv[1];
                 long double ld = (long double) atoi(argv[2]);
                 size_t st = (size_t) atoi(argv[3]);
-                bodygen gen{str,ld,st};
-                gen.simulate();
-                chrono::time_point end_time{chrono::steady_clock::now()};
-                chrono::duration<double> elapsed_time_seconds{end_time - start_time};
-                chrono::duration<double, milli> elapsed_time_milli{end_time - start_time};
-                cout << "Elapsed time: " << elapsed_time_seconds.count() << " seconds, ";
+                runsimulation(0, str, ld, st, options, start_time);
                 return 0;
             }
         }
@@ -83,12 +443,7 @@ int main(int argc, char* argv[])
         string str = (string) argv[2];
         long double ld = (long double) atoi(argv[3]);
         size_t st = (size_t) atoi(argv[4]);
-        bodygen gen{st1,str,ld,st};
-        gen.simulate();
-        chrono::time_point end_time{chrono::steady_clock::now()};
-        chrono::duration<double> elapsed_time_seconds{end_time - start_time};
-        chrono::duration<double, milli> elapsed_time_milli{end_time - start_time};
-        cout << "Elapsed time: " << elapsed_time_seconds.count() << " seconds, ";
+        runsimulation(st1, str, ld, st, options, start_time);
         return 0;
     }
 }
\ No newline at end of file